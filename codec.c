@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "log.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+struct td_codec_entry {
+	struct td_codec_entry *next;
+	struct td_codec *codec;
+};
+
+static struct td_codec *builtin_codecs[] = {
+	&td_mp4vdec_codec,
+	&td_h264vdec_codec,
+	&td_mp4venc_codec,
+	&td_h263venc_codec,
+	&td_jpegdec_codec,
+	&td_jpegenc_codec,
+	&td_aacdec_codec,
+	&td_mp3dec_codec,
+};
+
+/*
+ * The last registered comes first; the built-ins and the plugins are loaded
+ * before anything else is registered or looked up, so the application's
+ * codecs override the plugins, and those the built-ins.
+ */
+static struct td_codec_entry *codecs;
+static pthread_mutex_t codecs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t codecs_once = PTHREAD_ONCE_INIT;
+/* plugins register from within load_codecs() */
+static __thread bool loading_codecs;
+
+static void load_codecs(void);
+
+bool td_codec_register(struct td_codec *codec)
+{
+	struct td_codec_entry *e;
+
+	if (!loading_codecs)
+		pthread_once(&codecs_once, load_codecs);
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return false;
+
+	e->codec = codec;
+	pthread_mutex_lock(&codecs_lock);
+	e->next = codecs;
+	codecs = e;
+	pthread_mutex_unlock(&codecs_lock);
+
+	pr_info(NULL, "codec %s registered", codec->name);
+
+	return true;
+}
+
+static void load_plugin(const char *dir, const char *name)
+{
+	char path[256];
+	void *handle;
+	void (*init)(void);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle) {
+		pr_warning(NULL, "failed to load %s: %s", path, dlerror());
+		return;
+	}
+
+	*(void **) &init = dlsym(handle, "td_codec_plugin_init");
+	if (!init) {
+		pr_warning(NULL, "%s is not a codec plugin", path);
+		dlclose(handle);
+		return;
+	}
+
+	/* the plugin stays loaded; its codecs are registered for good */
+	init();
+}
+
+static void load_codecs(void)
+{
+	const char *dir;
+	struct dirent *de;
+	unsigned i;
+	DIR *d;
+
+	loading_codecs = true;
+
+	for (i = 0; i < ARRAY_SIZE(builtin_codecs); i++)
+		td_codec_register(builtin_codecs[i]);
+
+	dir = getenv("TIDSP_CODEC_DIR");
+	if (!dir)
+		dir = CODEC_DIR;
+
+	d = opendir(dir);
+	if (d) {
+		while ((de = readdir(d))) {
+			size_t len = strlen(de->d_name);
+			if (len < 3 || strcmp(de->d_name + len - 3, ".so") != 0)
+				continue;
+			load_plugin(dir, de->d_name);
+		}
+		closedir(d);
+	}
+
+	loading_codecs = false;
+}
+
+struct td_codec *td_codec_find(uint32_t fourcc, int dir)
+{
+	struct td_codec_entry *e;
+	struct td_codec *codec = NULL;
+
+	pthread_once(&codecs_once, load_codecs);
+
+	pthread_mutex_lock(&codecs_lock);
+	for (e = codecs; e; e = e->next) {
+		const uint32_t *f;
+		if (e->codec->dir != dir)
+			continue;
+		for (f = e->codec->fourccs; f && *f; f++) {
+			if (*f == fourcc) {
+				codec = e->codec;
+				goto leave;
+			}
+		}
+	}
+leave:
+	pthread_mutex_unlock(&codecs_lock);
+
+	return codec;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+#include "log.h"
+
+/*
+ * Audio frames are small and frequent; each buffer carries several of them
+ * (ctx->frames_per_buffer), so there is one message per buffer instead of
+ * one per frame, and the ports are deeper than for video.
+ */
+
+#define FRAMES_PER_BUFFER 8
+
+struct audio_format {
+	unsigned samples; /* per channel, per frame */
+	unsigned max_frame_size; /* compressed, per channel */
+};
+
+static const struct audio_format aac = { 1024, 768 };
+static const struct audio_format mp3 = { 1152, 1441 };
+
+static inline const struct audio_format *get_format(struct td_context *ctx)
+{
+	return ctx->codec == &td_mp3dec_codec ? &mp3 : &aac;
+}
+
+static inline unsigned frames_per_buffer(struct td_context *ctx)
+{
+	return ctx->frames_per_buffer ? ctx->frames_per_buffer : FRAMES_PER_BUFFER;
+}
+
+static inline unsigned channels(struct td_context *ctx)
+{
+	return ctx->channels ? ctx->channels : 2;
+}
+
+struct create_args {
+	uint32_t size;
+	uint16_t num_streams;
+
+	uint16_t in_id;
+	uint16_t in_type;
+	uint16_t in_count;
+
+	uint16_t out_id;
+	uint16_t out_type;
+	uint16_t out_count;
+
+	uint16_t reserved;
+
+	uint32_t sample_rate;
+	uint32_t channels;
+	uint32_t bits_per_sample;
+	uint32_t frames_per_buffer;
+	uint32_t interleaved;
+};
+
+static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg_data)
+{
+	struct create_args args = {
+		.size = sizeof(args) - 4,
+		.num_streams = 2,
+		.in_id = 0,
+		.in_type = 0,
+		.in_count = ctx->ports[0]->nr_buffers,
+		.out_id = 1,
+		.out_type = 0,
+		.out_count = ctx->ports[1]->nr_buffers,
+		.sample_rate = ctx->rate ? ctx->rate : 44100,
+		.channels = channels(ctx),
+		.bits_per_sample = 16,
+		.frames_per_buffer = frames_per_buffer(ctx),
+		.interleaved = 1,
+	};
+
+	*profile_id = 1;
+
+	*arg_data = malloc(sizeof(args));
+	memcpy(*arg_data, &args, sizeof(args));
+}
+
+struct in_params {
+	uint32_t frame_count;
+	uint32_t last_buffer;
+};
+
+struct out_params {
+	uint32_t frame_count;
+	uint32_t sample_rate;
+	uint32_t channels;
+	int32_t error_code;
+};
+
+static void in_send_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct in_params *param = tb->params->data;
+
+	param->frame_count = tb->frames ? tb->frames : 1;
+	param->last_buffer = tb->eos;
+	dmm_buffer_dirty(tb->params, 0, sizeof(*param));
+}
+
+static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct out_params *param = tb->params->data;
+
+	tb->frames = param->frame_count;
+	tb->keyframe = true;
+
+	/*
+	 * The buffers are sized, and the node created, for the configured
+	 * channels; more than that don't fit, so the samples are dropped.
+	 */
+	if (param->channels > channels(ctx)) {
+		if (param->channels != ctx->out_channels)
+			pr_err(ctx->client, "%u channels don't fit the %u configured",
+					param->channels, channels(ctx));
+		ctx->out_channels = param->channels;
+		tb->data->len = 0;
+		tb->frames = 0;
+		return;
+	}
+
+	if (param->sample_rate &&
+			(param->sample_rate != ctx->out_rate || param->channels != ctx->out_channels)) {
+		ctx->out_rate = param->sample_rate;
+		ctx->out_channels = param->channels;
+		pr_info(ctx->client, "%u Hz, %u channels", ctx->out_rate, ctx->out_channels);
+	}
+
+	if (param->error_code)
+		pr_warning(ctx->client, "decode error: 0x%x", param->error_code);
+}
+
+static void setup_params(struct td_context *ctx)
+{
+	struct in_params *in_param;
+	struct out_params *out_param;
+	struct td_port *p;
+
+	p = ctx->ports[0];
+	p->dirty_params = true;
+	td_port_setup_params(ctx, p, sizeof(*in_param), NULL);
+	p->send_cb = in_send_cb;
+
+	p = ctx->ports[1];
+	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
+	p->recv_cb = out_recv_cb;
+}
+
+/* by frame count; the width and height of the context don't apply */
+static void setup_buffer_sizes(struct td_context *ctx)
+{
+	const struct audio_format *f = get_format(ctx);
+	unsigned frames = frames_per_buffer(ctx);
+
+	ctx->input_buffer_size = frames * f->max_frame_size * channels(ctx);
+	ctx->output_buffer_size = frames * f->samples * channels(ctx) * 2;
+}
+
+struct td_codec td_aacdec_codec = {
+	.name = "aacdec",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('M', 'P', '4', 'A'),
+		td_fourcc('A', 'A', 'C', ' '),
+		0 },
+	.dir = TD_DECODER,
+	.uuid = &(const struct dsp_uuid) { 0x7ebc2a2c, 0x9a6b, 0x11d6, 0xb1, 0x56,
+		{ 0x00, 0xb0, 0xd0, 0x17, 0x67, 0x4b } },
+	.filename = DSP_DIR "mpeg4aacdec_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+	.depth = 6,
+};
+
+struct td_codec td_mp3dec_codec = {
+	.name = "mp3dec",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('M', 'P', '3', ' '),
+		td_fourcc('M', 'P', 'G', 'A'),
+		0 },
+	.dir = TD_DECODER,
+	.uuid = &(const struct dsp_uuid) { 0xbd2c9a88, 0x9a6b, 0x11d6, 0xb1, 0x56,
+		{ 0x00, 0xb0, 0xd0, 0x17, 0x67, 0x4b } },
+	.filename = DSP_DIR "mp3dec_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+	.depth = 6,
+};
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+#include "log.h"
+#include "td_vdec.h"
+
+#include <stddef.h> /* for offsetof */
+
+#define MAX_NALS 1200
+#define MAX_CONFIG_NALS 32
+#define MAX_CONFIG_SIZE 1024
+
+/*
+ * With avcC codec data the stream has length prefixed NAL units; they are
+ * stripped in place and the sizes go in the in_params instead, along with
+ * the SPS and PPS in front of the first frame.
+ */
+struct h264vdec_priv {
+	unsigned nal_length_size; /* 0 for a byte stream */
+	bool send_config;
+	unsigned config_count;
+	uint32_t config_sizes[MAX_CONFIG_NALS];
+	size_t config_len;
+	uint8_t config[MAX_CONFIG_SIZE];
+};
+
+struct create_args {
+	uint32_t size;
+	uint16_t num_streams;
+
+	uint16_t in_id;
+	uint16_t in_type;
+	uint16_t in_count;
+
+	uint16_t out_id;
+	uint16_t out_type;
+	uint16_t out_count;
+
+	uint16_t reserved;
+
+	uint32_t max_width;
+	uint32_t max_height;
+	uint32_t color_format;
+	uint32_t max_framerate;
+	uint32_t max_bitrate;
+	uint32_t endianness;
+	int32_t profile;
+	int32_t max_level;
+	uint32_t mode;
+	int32_t preroll;
+	uint32_t stream_format; /* 0 byte stream, 1 NAL units with sizes */
+	uint32_t display_width;
+};
+
+static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg_data)
+{
+	struct h264vdec_priv *priv = ctx->priv;
+	struct create_args args = {
+		.size = sizeof(args) - 4,
+		.num_streams = 2,
+		.in_id = 0,
+		.in_type = 0,
+		.in_count = ctx->ports[0]->nr_buffers,
+		.out_id = 1,
+		.out_type = 0,
+		.out_count = ctx->ports[1]->nr_buffers,
+		.max_width = ctx->width,
+		.max_height = ctx->height,
+		.color_format = ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y') ? 4 : 1,
+		.max_framerate = 0,
+		.max_bitrate = 0,
+		.endianness = 1,
+		.max_level = -1,
+		.stream_format = priv && priv->nal_length_size ? 1 : 0,
+	};
+
+	*profile_id = vdec_profile(ctx, &args.max_width, &args.max_height);
+
+	*arg_data = malloc(sizeof(args));
+	memcpy(*arg_data, &args, sizeof(args));
+}
+
+struct in_params {
+	uint32_t nal_count;
+	uint32_t size_array[MAX_NALS];
+};
+
+struct out_params {
+	uint32_t display_id;
+	uint32_t bytes_consumed;
+	int32_t error_code;
+	uint32_t frame_type;
+	uint32_t num_of_nalu;
+	int32_t mb_err_status_flag;
+	int8_t mb_err_status_out[MAX_MBS];
+};
+
+static bool add_config(struct h264vdec_priv *priv, const uint8_t **p, const uint8_t *end)
+{
+	size_t size;
+
+	if (end - *p < 2)
+		return false;
+	size = (*p)[0] << 8 | (*p)[1];
+	*p += 2;
+	if (size > (size_t) (end - *p))
+		return false;
+	if (priv->config_count >= MAX_CONFIG_NALS ||
+			priv->config_len + size > MAX_CONFIG_SIZE)
+		return false;
+
+	memcpy(priv->config + priv->config_len, *p, size);
+	priv->config_len += size;
+	priv->config_sizes[priv->config_count++] = size;
+	*p += size;
+
+	return true;
+}
+
+/* buf is a dmm_buffer with the codec data; call it before td_init() */
+static bool handle_extra_data(struct td_context *ctx, void *buf)
+{
+	dmm_buffer_t *b = buf;
+	struct h264vdec_priv *priv = ctx->priv;
+	const uint8_t *p = b->data, *end = p + b->len;
+	unsigned i, count;
+
+	if (!priv) {
+		priv = ctx->priv = calloc(1, sizeof(*priv));
+		if (!priv)
+			return false;
+	}
+
+	/* Annex B codec data; the parameter sets are in the stream */
+	if (b->len < 7 || p[0] != 1) {
+		priv->nal_length_size = 0;
+		return true;
+	}
+
+	priv->nal_length_size = (p[4] & 0x3) + 1;
+	priv->config_count = 0;
+	priv->config_len = 0;
+
+	count = p[5] & 0x1f;
+	p += 6;
+	for (i = 0; i < count; i++)
+		if (!add_config(priv, &p, end))
+			goto bad;
+
+	if (p >= end)
+		goto bad;
+	count = *p++;
+	for (i = 0; i < count; i++)
+		if (!add_config(priv, &p, end))
+			goto bad;
+
+	priv->send_config = true;
+	pr_info(ctx->client, "avc: nal length size %u, %u parameter sets",
+			priv->nal_length_size, priv->config_count);
+
+	return true;
+
+bad:
+	pr_err(ctx->client, "bad avcC codec data");
+	priv->nal_length_size = 0;
+	return false;
+}
+
+/*
+ * Strips the NAL length prefixes in place, and puts the sizes in the params;
+ * the application's input buffer is modified, and has to be cleaned again.
+ */
+static void in_send_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct h264vdec_priv *priv = ctx->priv;
+	struct in_params *param = tb->params->data;
+	dmm_buffer_t *b = tb->data;
+	uint8_t *data = b->data, *src = data, *dst = data, *end = data + b->len;
+	unsigned length_size, count = 0;
+
+	if (!priv || !priv->nal_length_size) {
+		param->nal_count = 0;
+		dmm_buffer_dirty(tb->params, 0, sizeof(param->nal_count));
+		return;
+	}
+
+	length_size = priv->nal_length_size;
+	while (end - src >= (ptrdiff_t) length_size && count < MAX_NALS) {
+		size_t size = 0;
+		unsigned i;
+
+		for (i = 0; i < length_size; i++)
+			size = size << 8 | src[i];
+		src += length_size;
+		if (size > (size_t) (end - src)) {
+			pr_warning(ctx->client, "truncated nal unit");
+			break;
+		}
+		memmove(dst, src, size);
+		param->size_array[count++] = size;
+		dst += size;
+		src += size;
+	}
+	b->len = dst - data;
+	tb->clean = false;
+
+	if (priv->send_config) {
+		if (b->len + priv->config_len > b->size ||
+				count + priv->config_count > MAX_NALS) {
+			/* the decoder can't do without them; try with the next one */
+			pr_warning(ctx->client, "no room for the parameter sets");
+		} else {
+			memmove(data + priv->config_len, data, b->len);
+			memcpy(data, priv->config, priv->config_len);
+			memmove(param->size_array + priv->config_count, param->size_array,
+					count * sizeof(param->size_array[0]));
+			memcpy(param->size_array, priv->config_sizes,
+					priv->config_count * sizeof(param->size_array[0]));
+			b->len += priv->config_len;
+			count += priv->config_count;
+			priv->send_config = false;
+		}
+	}
+
+	param->nal_count = count;
+	dmm_buffer_dirty(tb->params, 0,
+			offsetof(struct in_params, size_array) + count * sizeof(param->size_array[0]));
+}
+
+static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct out_params *param = tb->params->data;
+
+	/* the header is invalidated already */
+	if (!ctx->no_mb_info)
+		dmm_buffer_end_range(tb->params, offsetof(struct out_params, mb_err_status_out),
+				mb_count(ctx));
+
+	tb->keyframe = (param->frame_type == 0);
+
+	pr_debug(ctx->client, "error: 0x%x, frame number: %u, frame type: %u",
+			param->error_code, param->display_id, param->frame_type);
+}
+
+static void setup_params(struct td_context *ctx)
+{
+	struct in_params *in_param;
+	struct out_params *out_param;
+	struct h264vdec_priv *priv = ctx->priv;
+	struct td_port *p;
+	unsigned i;
+
+	/* a new or restarted node needs the parameter sets again */
+	if (priv)
+		priv->send_config = true;
+
+	p = ctx->ports[0];
+	p->dirty_params = true;
+	td_port_setup_params(ctx, p, sizeof(*in_param), NULL);
+	p->send_cb = in_send_cb;
+
+	p = ctx->ports[1];
+	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
+	p->recv_cb = out_recv_cb;
+
+	/* the macroblock info is read back in out_recv_cb, if wanted */
+	for (i = 0; i < p->nr_buffers; i++)
+		dmm_buffer_track(p->buffers[i].params, 0,
+				offsetof(struct out_params, mb_err_status_out));
+}
+
+static void flush_buffer(struct td_context *ctx)
+{
+	struct h264vdec_priv *priv = ctx->priv;
+
+	if (priv)
+		priv->send_config = true;
+}
+
+struct td_codec td_h264vdec_codec = {
+	.name = "h264vdec",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('H', '2', '6', '4'),
+		td_fourcc('A', 'V', 'C', '1'),
+		0 },
+	.dir = TD_DECODER,
+	.uuid = &(const struct dsp_uuid) { 0xCB1E9F0F, 0x9D5A, 0x4434, 0x84, 0x49,
+		{ 0x1F, 0xED, 0x2F, 0x99, 0x2D, 0xF7 } },
+	.filename = DSP_DIR "h264vdec_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.handle_extra_data = handle_extra_data,
+	.flush_buffer = flush_buffer,
+};
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+#include "log.h"
+#include "td_tiers.h"
+
+/*
+ * The node is created for images up to ctx->width x ctx->height; any
+ * number of smaller ones can go through it, each buffer reports the size
+ * of its image.
+ */
+
+struct create_args {
+	uint32_t size;
+	uint16_t num_streams;
+
+	uint16_t in_id;
+	uint16_t in_type;
+	uint16_t in_count;
+
+	uint16_t out_id;
+	uint16_t out_type;
+	uint16_t out_count;
+
+	uint16_t max_height;
+	uint16_t max_width;
+	uint16_t progressive;
+	uint16_t color_format;
+	uint16_t unknown;
+	uint32_t sections_input;
+	uint32_t sections_output;
+	uint32_t is_argb32;
+};
+
+static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg_data)
+{
+	struct create_args args = {
+		.size = sizeof(args) - 4,
+		.num_streams = 2,
+		.in_id = 0,
+		.in_type = 0,
+		.in_count = ctx->ports[0]->nr_buffers,
+		.out_id = 1,
+		.out_type = 0,
+		.out_count = ctx->ports[1]->nr_buffers,
+		.max_height = ctx->height,
+		.max_width = ctx->width,
+		.progressive = 0,
+		.color_format = ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y') ? 4 : 1,
+	};
+
+	*profile_id = jpeg_tier(ctx);
+
+	*arg_data = malloc(sizeof(args));
+	memcpy(*arg_data, &args, sizeof(args));
+}
+
+struct in_params {
+	int32_t buf_count;
+	uint32_t frame_count;
+	uint32_t frame_align;
+	uint32_t frame_size;
+	uint32_t display_width;
+	uint32_t reserved_0;
+	uint32_t reserved_1;
+	uint32_t reserved_2;
+	uint32_t reserved_3;
+	uint32_t resize_option;
+	uint32_t num_mcu;
+	uint32_t decode_header;
+	uint32_t max_height;
+	uint32_t max_width;
+	uint32_t max_scans;
+	uint32_t endianness;
+	uint32_t color_format;
+	uint32_t rgb_format;
+	uint32_t num_mcu_rows;
+	uint32_t x_org;
+	uint32_t y_org;
+	uint32_t x_length;
+	uint32_t y_length;
+	uint32_t argb;
+	uint32_t total_size;
+};
+
+struct out_params {
+	uint32_t errortype;
+	uint32_t frame_count;
+	uint32_t frame_align;
+	uint32_t frame_size;
+	uint32_t display_width;
+	uint32_t reserved_0;
+	uint32_t reserved_1;
+	uint32_t reserved_2;
+	uint32_t reserved_3;
+	uint32_t last_mcu;
+	uint32_t stride[3];
+	uint32_t output_height;
+	uint32_t output_width;
+	uint32_t total_au;
+	uint32_t bytes_consumed;
+	uint32_t current_ac;
+	uint32_t current_dc;
+	uint32_t num_of_mcu;
+	uint32_t image_width;
+	uint32_t image_height;
+	uint32_t progressive;
+};
+
+static void setup_in_params(struct td_context *ctx, dmm_buffer_t *tmp)
+{
+	struct in_params *in_param = tmp->data;
+
+	in_param->frame_count = 1;
+	in_param->frame_align = 4;
+	in_param->display_width = ctx->width;
+	in_param->max_height = ctx->height;
+	in_param->max_width = ctx->width;
+	in_param->color_format = ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y') ? 4 : 1;
+}
+
+static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct out_params *param = tb->params->data;
+
+	tb->width = param->image_width;
+	tb->height = param->image_height;
+	tb->keyframe = true;
+
+	if (param->errortype)
+		pr_warning(ctx->client, "decode error: 0x%x", param->errortype);
+}
+
+static void setup_params(struct td_context *ctx)
+{
+	struct in_params *in_param;
+	struct out_params *out_param;
+	struct td_port *p;
+
+	p = ctx->ports[0];
+	td_port_setup_params(ctx, p, sizeof(*in_param), setup_in_params);
+
+	p = ctx->ports[1];
+	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
+	p->recv_cb = out_recv_cb;
+}
+
+/* compressed images are well below a raw one of the maximum size */
+static void setup_buffer_sizes(struct td_context *ctx)
+{
+	size_t pixels = ctx->width * ctx->height;
+
+	ctx->input_buffer_size = ROUND_UP(pixels, PAGE_SIZE);
+	if (ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y'))
+		ctx->output_buffer_size = pixels * 2;
+	else
+		ctx->output_buffer_size = pixels * 3 / 2;
+}
+
+struct td_codec td_jpegdec_codec = {
+	.name = "jpegdec",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('J', 'P', 'E', 'G'),
+		td_fourcc('M', 'J', 'P', 'G'),
+		0 },
+	.dir = TD_DECODER,
+	.uuid = &(const struct dsp_uuid) { 0x5D9CB711, 0x4645, 0x11d6, 0xb1, 0x56,
+		{ 0x00, 0xb0, 0xd0, 0x17, 0x67, 0x4b } },
+	.filename = DSP_DIR "jpegdec_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+};
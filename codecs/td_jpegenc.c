@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+#include "log.h"
+#include "td_tiers.h"
+
+/*
+ * The node is created for images up to ctx->width x ctx->height; the size
+ * of each image is taken from its input buffer, if set.
+ */
+
+struct create_args {
+	uint32_t size;
+	uint16_t num_streams;
+
+	uint16_t in_id;
+	uint16_t in_type;
+	uint16_t in_count;
+
+	uint16_t out_id;
+	uint16_t out_type;
+	uint16_t out_count;
+
+	uint16_t max_width;
+	uint16_t max_height;
+	uint16_t color_format;
+	uint16_t max_app0_width;
+	uint16_t max_app0_height;
+	uint16_t max_app1_width;
+	uint16_t max_app1_height;
+	uint16_t max_app13_width;
+	uint16_t max_app13_height;
+	uint16_t scans;
+};
+
+static inline unsigned color_format(struct td_context *ctx)
+{
+	return ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y') ? 4 : 1;
+}
+
+static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg_data)
+{
+	struct create_args args = {
+		.size = sizeof(args) - 4,
+		.num_streams = 2,
+		.in_id = 0,
+		.in_type = 0,
+		.in_count = ctx->ports[0]->nr_buffers,
+		.out_id = 1,
+		.out_type = 0,
+		.out_count = ctx->ports[1]->nr_buffers,
+		.max_width = ctx->width,
+		.max_height = ctx->height,
+		.color_format = color_format(ctx),
+		.scans = 1,
+	};
+
+	*profile_id = jpeg_tier(ctx);
+
+	*arg_data = malloc(sizeof(args));
+	memcpy(*arg_data, &args, sizeof(args));
+}
+
+struct in_params {
+	uint32_t size;
+	uint32_t num_au;
+	uint32_t color_format;
+	uint32_t height;
+	uint32_t width;
+	uint32_t capture_width;
+	uint32_t gen_header;
+	uint32_t quality;
+	uint32_t capture_height;
+	uint32_t dri_interval;
+	uint32_t huffman_table;
+	uint32_t quant_table;
+};
+
+struct out_params {
+	uint32_t errortype;
+	uint32_t bytes_produced;
+};
+
+static void setup_in_params(struct td_context *ctx, dmm_buffer_t *tmp)
+{
+	struct in_params *in_param = tmp->data;
+
+	in_param->size = sizeof(*in_param);
+	in_param->color_format = color_format(ctx);
+	in_param->gen_header = 1;
+}
+
+/* each image may have its own size */
+static void in_send_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct in_params *param = tb->params->data;
+	unsigned width = tb->width ? tb->width : (unsigned) ctx->width;
+	unsigned height = tb->height ? tb->height : (unsigned) ctx->height;
+
+	param->height = param->capture_height = height;
+	param->width = param->capture_width = width;
+	param->quality = ctx->quality ? ctx->quality : 90;
+
+	dmm_buffer_dirty(tb->params, 0, sizeof(*param));
+}
+
+static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct out_params *param = tb->params->data;
+
+	tb->keyframe = true;
+
+	if (param->errortype)
+		pr_warning(ctx->client, "encode error: 0x%x", param->errortype);
+}
+
+static void setup_params(struct td_context *ctx)
+{
+	struct in_params *in_param;
+	struct out_params *out_param;
+	struct td_port *p;
+
+	p = ctx->ports[0];
+	p->dirty_params = true;
+	td_port_setup_params(ctx, p, sizeof(*in_param), setup_in_params);
+	p->send_cb = in_send_cb;
+
+	p = ctx->ports[1];
+	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
+	p->recv_cb = out_recv_cb;
+}
+
+/* raw images in; even at full quality the result fits in a byte per pixel */
+static void setup_buffer_sizes(struct td_context *ctx)
+{
+	size_t pixels = ctx->width * ctx->height;
+
+	if (ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y'))
+		ctx->input_buffer_size = pixels * 2;
+	else
+		ctx->input_buffer_size = pixels * 3 / 2;
+	ctx->output_buffer_size = ROUND_UP(pixels + 0x1000, PAGE_SIZE);
+}
+
+struct td_codec td_jpegenc_codec = {
+	.name = "jpegenc",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('J', 'P', 'E', 'G'),
+		td_fourcc('M', 'J', 'P', 'G'),
+		0 },
+	.dir = TD_ENCODER,
+	.uuid = &(const struct dsp_uuid) { 0xcb70c0c1, 0x4c85, 0x11d6, 0xb1, 0x05,
+		{ 0x00, 0xc0, 0x4f, 0x32, 0x90, 0x31 } },
+	.filename = DSP_DIR "jpegenc_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+};
@@ -11,6 +11,9 @@
 #include "tidsp.h"
 #include "dsp_bridge.h"
 #include "dmm_buffer.h"
+#include "td_vdec.h"
+
+#include <stddef.h> /* for offsetof */
 
 struct create_args {
 	uint32_t size;
@@ -59,14 +62,7 @@ static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg
 		.max_level = -1,
 	};
 
-	if (ctx->width * ctx->height > 640 * 480)
-		*profile_id = 4;
-	else if (ctx->width * ctx->height > 352 * 288)
-		*profile_id = 3;
-	else if (ctx->width * ctx->height > 176 * 144)
-		*profile_id = 2;
-	else
-		*profile_id = 1;
+	*profile_id = vdec_profile(ctx, &args.max_width, &args.max_height);
 
 	*arg_data = malloc(sizeof(args));
 	memcpy(*arg_data, &args, sizeof(args));
@@ -79,20 +75,34 @@ struct in_params {
 	int32_t performance_mode;
 };
 
+/*
+ * The DSP writes this layout whatever the resolution, so the arrays keep
+ * their maximum size; only the entries of the actual macroblocks are read
+ * back.
+ */
 struct out_params {
 	uint32_t frame_index;
 	uint32_t bytes_consumed;
 	int32_t error_code;
 	uint32_t frame_type;
-	uint32_t qp[(720 * 576) / 256];
+	uint32_t qp[MAX_MBS];
 	int32_t mb_error_buf_flag;
-	uint8_t mb_error_buf[(720 * 576) / 256];
+	uint8_t mb_error_buf[MAX_MBS];
 };
 
 static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
 {
 	struct out_params *param = tb->params->data;
 
+	/* the header is invalidated already */
+	if (!ctx->no_mb_info) {
+		unsigned count = mb_count(ctx);
+		dmm_buffer_end_range(tb->params, offsetof(struct out_params, qp),
+				count * sizeof(param->qp[0]));
+		dmm_buffer_end_range(tb->params, offsetof(struct out_params, mb_error_buf_flag),
+				sizeof(param->mb_error_buf_flag) + count);
+	}
+
 	tb->keyframe = (param->frame_type == 0);
 
 	pr_debug(ctx->client, "error: 0x%x, frame number: %u, frame type: %u",
@@ -104,7 +114,20 @@ static void setup_in_params(struct td_context *ctx, dmm_buffer_t *tmp)
 	struct in_params *in_param;
 
 	in_param = tmp->data;
-	in_param->performance_mode = 0;
+	in_param->performance_mode = ctx->performance_mode;
+}
+
+/* the params are only written by the CPU, so the cached copy is current */
+static void in_send_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct in_params *param = tb->params->data;
+
+	if (param->performance_mode == ctx->performance_mode)
+		return;
+
+	param->performance_mode = ctx->performance_mode;
+	dmm_buffer_dirty(tb->params, offsetof(struct in_params, performance_mode),
+			sizeof(param->performance_mode));
 }
 
 static void setup_params(struct td_context *ctx)
@@ -112,16 +135,29 @@ static void setup_params(struct td_context *ctx)
 	struct in_params *in_param;
 	struct out_params *out_param;
 	struct td_port *p;
+	unsigned i;
 
 	p = ctx->ports[0];
+	p->dirty_params = true;
 	td_port_setup_params(ctx, p, sizeof(*in_param), setup_in_params);
+	p->send_cb = in_send_cb;
 
 	p = ctx->ports[1];
 	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
 	p->recv_cb = out_recv_cb;
+
+	/* the macroblock info is read back in out_recv_cb, if wanted */
+	for (i = 0; i < p->nr_buffers; i++)
+		dmm_buffer_track(p->buffers[i].params, 0, offsetof(struct out_params, qp));
 }
 
 struct td_codec td_mp4vdec_codec = {
+	.name = "mp4vdec",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('M', 'P', '4', 'V'),
+		td_fourcc('H', '2', '6', '3'),
+		0 },
+	.dir = TD_DECODER,
 	.uuid = &(const struct dsp_uuid) { 0x7e4b8541, 0x47a1, 0x11d6, 0xb1, 0x56,
 		{ 0x00, 0xb0, 0xd0, 0x17, 0x67, 0x4b } },
 	.filename = DSP_DIR "mp4vdec_sn.dll64P",
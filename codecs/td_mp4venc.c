@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+#include "log.h"
+#include "td_tiers.h"
+
+#include <stddef.h> /* for offsetof */
+
+/* the roles are reversed; raw frames go in on port 0, the bitstream comes out on port 1 */
+
+struct create_args {
+	uint32_t size;
+	uint16_t num_streams;
+
+	uint16_t in_id;
+	uint16_t in_type;
+	uint16_t in_count;
+
+	uint16_t out_id;
+	uint16_t out_type;
+	uint16_t out_count;
+
+	uint16_t reserved;
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t bitrate;
+	uint32_t vbv_size;
+	uint32_t gob_interval;
+
+	uint8_t is_mpeg4;
+	uint8_t color_format;
+	uint8_t hec;
+	uint8_t resync_marker;
+	uint8_t data_part;
+	uint8_t reversible_vlc;
+	uint8_t unrestricted_mv;
+	uint8_t framerate;
+	uint8_t rate_control;
+	uint8_t qp_first;
+	uint8_t profile;
+	uint8_t level;
+	uint32_t max_delay;
+
+	uint32_t vbv_enable;
+	uint32_t h263_slice_mode;
+
+	uint32_t use_gov;
+	uint32_t use_vos;
+	uint32_t h263_annex_i;
+	uint32_t h263_annex_j;
+	uint32_t h263_annex_t;
+};
+
+static inline bool is_mpeg4(struct td_context *ctx)
+{
+	return ctx->codec != &td_h263venc_codec;
+}
+
+/* the settings of the context, or the defaults for the current size */
+static inline unsigned bitrate(struct td_context *ctx)
+{
+	return ctx->bitrate ? ctx->bitrate : (unsigned) (ctx->width * ctx->height) * 2;
+}
+
+static inline unsigned framerate(struct td_context *ctx)
+{
+	return ctx->framerate ? ctx->framerate : 15;
+}
+
+static inline unsigned keyframe_interval(struct td_context *ctx)
+{
+	return ctx->keyframe_interval ? ctx->keyframe_interval : framerate(ctx);
+}
+
+static void create_args(struct td_context *ctx, unsigned *profile_id, void **arg_data)
+{
+	struct create_args args = {
+		.size = sizeof(args) - 4,
+		.num_streams = 2,
+		.in_id = 0,
+		.in_type = 0,
+		.in_count = ctx->ports[0]->nr_buffers,
+		.out_id = 1,
+		.out_type = 0,
+		.out_count = ctx->ports[1]->nr_buffers,
+		.width = ctx->width,
+		.height = ctx->height,
+		.bitrate = bitrate(ctx),
+		.is_mpeg4 = is_mpeg4(ctx),
+		.color_format = ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y') ? 2 : 0,
+		.unrestricted_mv = 1,
+		/* only a hint for the start; each frame carries the real one */
+		.framerate = framerate(ctx) > UINT8_MAX ? UINT8_MAX : framerate(ctx),
+		.rate_control = 1, /* variable bitrate */
+		.qp_first = 12,
+		.profile = 1,
+		.max_delay = 300,
+		.vbv_enable = 1,
+		.use_vos = 1,
+	};
+
+	*profile_id = video_tier(ctx);
+
+	if (is_mpeg4(ctx))
+		args.level = *profile_id > 2 ? 5 : *profile_id;
+	else
+		args.level = *profile_id > 2 ? 50 : *profile_id * 10;
+
+	*arg_data = malloc(sizeof(args));
+	memcpy(*arg_data, &args, sizeof(args));
+}
+
+struct in_params {
+	uint32_t frame_index;
+	uint32_t framerate;
+	uint32_t bitrate;
+	uint32_t i_frame_interval;
+	uint32_t generate_header;
+	uint32_t force_i_frame;
+	uint32_t resync_interval;
+	uint32_t hec_interval;
+	uint32_t air_rate;
+	uint32_t mir_rate;
+	uint32_t qp_intra;
+	uint32_t f_code;
+	uint32_t half_pel;
+	uint32_t ac_pred;
+	uint32_t mv;
+	uint32_t use_umv;
+	uint32_t mv_data_enable;
+	uint32_t resync_data_enable;
+	uint32_t qp_inter;
+	uint32_t last_frame;
+	uint32_t width;
+	uint32_t qp_max;
+	uint32_t qp_min;
+};
+
+struct out_params {
+	uint32_t bitstream_size;
+	uint32_t frame_type;
+	uint32_t mv_data_size;
+	uint32_t num_packets;
+};
+
+static void setup_in_params(struct td_context *ctx, dmm_buffer_t *tmp)
+{
+	struct in_params *in_param = tmp->data;
+
+	in_param->resync_interval = 1024;
+	in_param->hec_interval = 3;
+	in_param->qp_intra = 8;
+	in_param->f_code = 6;
+	in_param->half_pel = 1;
+	in_param->use_umv = 1;
+	in_param->qp_inter = 8;
+	in_param->width = ctx->width;
+	in_param->qp_max = 31;
+	in_param->qp_min = 2;
+}
+
+/* the dynamic parameters go with every frame, so changes apply from the next one */
+static void in_send_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct in_params *param = tb->params->data;
+	static const size_t start = offsetof(struct in_params, frame_index);
+	static const size_t end = offsetof(struct in_params, resync_interval);
+
+	param->frame_index = ctx->frame_index++;
+	param->framerate = framerate(ctx) * 1000;
+	param->bitrate = bitrate(ctx);
+	param->i_frame_interval = keyframe_interval(ctx);
+	param->generate_header = 0;
+	param->force_i_frame = ctx->force_keyframe;
+	ctx->force_keyframe = false;
+
+	dmm_buffer_dirty(tb->params, start, end - start);
+}
+
+static void out_recv_cb(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct out_params *param = tb->params->data;
+
+	tb->keyframe = (param->frame_type == 1);
+
+	pr_debug(ctx->client, "bitstream size: %u, frame type: %u",
+			param->bitstream_size, param->frame_type);
+}
+
+static void setup_params(struct td_context *ctx)
+{
+	struct in_params *in_param;
+	struct out_params *out_param;
+	struct td_port *p;
+
+	ctx->frame_index = 0;
+
+	p = ctx->ports[0];
+	p->dirty_params = true;
+	td_port_setup_params(ctx, p, sizeof(*in_param), setup_in_params);
+	p->send_cb = in_send_cb;
+
+	p = ctx->ports[1];
+	td_port_setup_params(ctx, p, sizeof(*out_param), NULL);
+	p->recv_cb = out_recv_cb;
+}
+
+static void flush_buffer(struct td_context *ctx)
+{
+	ctx->frame_index = 0;
+}
+
+/* raw frames in; the bitstream of a frame is bounded by half a byte per pixel */
+static void setup_buffer_sizes(struct td_context *ctx)
+{
+	size_t pixels = ctx->width * ctx->height;
+
+	if (ctx->color_format == td_fourcc('U', 'Y', 'V', 'Y'))
+		ctx->input_buffer_size = pixels * 2;
+	else
+		ctx->input_buffer_size = pixels * 3 / 2;
+	ctx->output_buffer_size = ROUND_UP(pixels / 2, PAGE_SIZE);
+}
+
+struct td_codec td_mp4venc_codec = {
+	.name = "mp4venc",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('M', 'P', '4', 'V'),
+		0 },
+	.dir = TD_ENCODER,
+	.uuid = &(const struct dsp_uuid) { 0x98c2e8d8, 0x4644, 0x11d6, 0x81, 0x18,
+		{ 0x00, 0xb0, 0xd0, 0x8d, 0x72, 0x9f } },
+	.filename = DSP_DIR "m4venc_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+	.flush_buffer = flush_buffer,
+};
+
+struct td_codec td_h263venc_codec = {
+	.name = "h263venc",
+	.fourccs = (const uint32_t []) {
+		td_fourcc('H', '2', '6', '3'),
+		0 },
+	.dir = TD_ENCODER,
+	.uuid = &(const struct dsp_uuid) { 0x98c2e8d8, 0x4644, 0x11d6, 0x81, 0x18,
+		{ 0x00, 0xb0, 0xd0, 0x8d, 0x72, 0x9f } },
+	.filename = DSP_DIR "m4venc_sn.dll64P",
+	.setup_params = setup_params,
+	.create_args = create_args,
+	.setup_buffer_sizes = setup_buffer_sizes,
+	.flush_buffer = flush_buffer,
+};
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef TD_TIERS_H
+#define TD_TIERS_H
+
+#include "tidsp.h"
+#include "util.h"
+
+/*
+ * Profile tiers of the frame size, by area; the tier is 1 plus the number
+ * of bounds, in ascending order, the frame exceeds.
+ */
+static inline unsigned area_tier(struct td_context *ctx,
+		const unsigned *bounds, unsigned count)
+{
+	unsigned area = ctx->width * ctx->height;
+	unsigned tier = 1;
+
+	while (tier <= count && area > bounds[tier - 1])
+		tier++;
+
+	return tier;
+}
+
+/* QCIF, CIF, VGA and larger; the video codecs */
+static inline unsigned video_tier(struct td_context *ctx)
+{
+	static const unsigned bounds[] = { 176 * 144, 352 * 288, 640 * 480 };
+
+	return area_tier(ctx, bounds, ARRAY_SIZE(bounds));
+}
+
+/* up to VGA, up to SXGA and larger; the jpeg codecs */
+static inline unsigned jpeg_tier(struct td_context *ctx)
+{
+	static const unsigned bounds[] = { 640 * 480, 1280 * 1024 };
+
+	return area_tier(ctx, bounds, ARRAY_SIZE(bounds));
+}
+
+#endif /* TD_TIERS_H */
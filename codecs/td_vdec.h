@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef TD_VDEC_H
+#define TD_VDEC_H
+
+#include "tidsp.h"
+#include "td_tiers.h"
+
+/* the video decoder nodes handle up to D1 */
+#define MAX_MBS ((720 * 576) / 256)
+
+/*
+ * Profile of the frame size, its video tier; the node is created for the
+ * largest size of its tier, so max_width and max_height are raised to it.
+ */
+static inline unsigned vdec_profile(struct td_context *ctx,
+		uint32_t *max_width, uint32_t *max_height)
+{
+	static const struct {
+		unsigned width, height;
+	} tiers[] = {
+		{ 176, 144 },
+		{ 352, 288 },
+		{ 640, 480 },
+		{ 720, 576 },
+	};
+	unsigned profile_id = video_tier(ctx);
+
+	if (*max_width < tiers[profile_id - 1].width)
+		*max_width = tiers[profile_id - 1].width;
+	if (*max_height < tiers[profile_id - 1].height)
+		*max_height = tiers[profile_id - 1].height;
+
+	return profile_id;
+}
+
+static inline unsigned mb_count(struct td_context *ctx)
+{
+	unsigned count = ((ctx->width + 15) / 16) * ((ctx->height + 15) / 16);
+
+	return count < MAX_MBS ? count : MAX_MBS;
+}
+
+#endif /* TD_VDEC_H */
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "tidsp.h"
+#include "dmm_arena.h"
+#include "dmm_buffer.h"
+#include "log.h"
+
+/* all the extents, used and free, sorted by address */
+struct dmm_extent {
+	struct dmm_extent *prev, *next;
+	unsigned long start;
+	size_t size;
+	bool used;
+};
+
+struct dmm_arena {
+	int handle;
+	void *proc;
+	void *base;
+	size_t size;
+	struct dmm_extent *extents;
+	size_t free_size;
+	unsigned allocations;
+	unsigned failures;
+};
+
+struct dmm_arena *dmm_arena_new(int handle, void *proc, size_t size)
+{
+	struct dmm_arena *a;
+	struct dmm_extent *e;
+
+	a = calloc(1, sizeof(*a));
+	e = calloc(1, sizeof(*e));
+	if (!a || !e)
+		goto fail;
+
+	size = ROUND_UP(size, PAGE_SIZE);
+
+	if (!dsp_reserve(handle, proc, size, &a->base)) {
+		pr_err(NULL, "failed to reserve %zu bytes of DSP memory", size);
+		goto fail;
+	}
+
+	a->handle = handle;
+	a->proc = proc;
+	a->size = a->free_size = size;
+
+	e->start = (unsigned long) a->base;
+	e->size = size;
+	a->extents = e;
+
+	return a;
+
+fail:
+	free(e);
+	free(a);
+	return NULL;
+}
+
+void dmm_arena_free(struct dmm_arena *a)
+{
+	struct dmm_extent *e, *next;
+
+	if (!a)
+		return;
+
+	for (e = a->extents; e; e = next) {
+		next = e->next;
+		if (e->used)
+			pr_warning(NULL, "arena slice 0x%lx still in use", e->start);
+		free(e);
+	}
+
+	dsp_unreserve(a->handle, a->proc, a->base);
+	free(a);
+}
+
+void *dmm_arena_alloc(struct dmm_arena *a, size_t size)
+{
+	struct dmm_extent *e, *best = NULL;
+
+	size = ROUND_UP(size, PAGE_SIZE);
+
+	/* best fit keeps the large extents around for large frames */
+	for (e = a->extents; e; e = e->next) {
+		if (e->used || e->size < size)
+			continue;
+		if (!best || e->size < best->size)
+			best = e;
+		if (e->size == size)
+			break;
+	}
+
+	if (!best) {
+		a->failures++;
+		return NULL;
+	}
+
+	if (best->size > size) {
+		struct dmm_extent *rest;
+
+		rest = calloc(1, sizeof(*rest));
+		if (!rest) {
+			a->failures++;
+			return NULL;
+		}
+
+		rest->start = best->start + size;
+		rest->size = best->size - size;
+		rest->prev = best;
+		rest->next = best->next;
+		if (best->next)
+			best->next->prev = rest;
+		best->next = rest;
+		best->size = size;
+	}
+
+	best->used = true;
+	a->free_size -= size;
+	a->allocations++;
+
+	return (void *) best->start;
+}
+
+static inline void merge_next(struct dmm_arena *a, struct dmm_extent *e)
+{
+	struct dmm_extent *next = e->next;
+
+	e->size += next->size;
+	e->next = next->next;
+	if (next->next)
+		next->next->prev = e;
+	free(next);
+}
+
+bool dmm_arena_release(struct dmm_arena *a, void *addr)
+{
+	unsigned long start = (unsigned long) addr;
+	struct dmm_extent *e;
+
+	if (start < (unsigned long) a->base || start >= (unsigned long) a->base + a->size)
+		return false;
+
+	for (e = a->extents; e; e = e->next)
+		if (e->start == start)
+			break;
+
+	if (!e || !e->used) {
+		pr_err(NULL, "bad arena release: 0x%lx", start);
+		return true;
+	}
+
+	e->used = false;
+	a->free_size += e->size;
+	a->allocations--;
+
+	if (e->next && !e->next->used)
+		merge_next(a, e);
+	if (e->prev && !e->prev->used)
+		merge_next(a, e->prev);
+
+	return true;
+}
+
+void dmm_arena_get_stats(struct dmm_arena *a, struct td_arena_stats *stats)
+{
+	struct dmm_extent *e;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->size = a->size;
+	stats->free = a->free_size;
+	stats->allocations = a->allocations;
+	stats->failures = a->failures;
+
+	for (e = a->extents; e; e = e->next) {
+		if (e->used)
+			continue;
+		stats->free_blocks++;
+		if (e->size > stats->largest_free)
+			stats->largest_free = e->size;
+	}
+
+	if (stats->free)
+		stats->fragmentation = 100 - stats->largest_free * 100 / stats->free;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef DMM_ARENA_H
+#define DMM_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct dmm_arena;
+struct td_arena_stats;
+
+/*
+ * One big DSP virtual address reservation, handed out in page aligned
+ * slices, so buffers don't need a PROC_RSVMEM/PROC_UNRSVMEM of their own.
+ */
+struct dmm_arena *dmm_arena_new(int handle, void *proc, size_t size);
+void dmm_arena_free(struct dmm_arena *a);
+
+void *dmm_arena_alloc(struct dmm_arena *a, size_t size);
+/* returns false if addr doesn't belong to the arena */
+bool dmm_arena_release(struct dmm_arena *a, void *addr);
+
+void dmm_arena_get_stats(struct dmm_arena *a, struct td_arena_stats *stats);
+
+#endif /* DMM_ARENA_H */
@@ -16,12 +16,17 @@
 
 #include <stdlib.h> /* for calloc, free */
 #include <string.h> /* for memset */
+#include <sys/mman.h> /* for mmap */
 
 #include "dsp_bridge.h"
+#include "trace.h"
+#include "dmm_arena.h"
 #include "log.h"
 
 #define ROUND_UP(num, scale) (((num) + ((scale) - 1)) & ~((scale) - 1))
 #define PAGE_SIZE 0x1000
+#define HUGE_PAGE_SIZE 0x200000
+#define DSP_SECTION_SIZE 0x100000
 
 enum dma_data_direction {
 	DMA_BIDIRECTIONAL,
@@ -40,38 +45,127 @@ static inline dmm_buffer_t *dmm_buffer_new(int handle, void *proc, int dir)
 	b->handle = handle;
 	b->proc = proc;
 	b->dir = dir;
+	b->read_end = (size_t) -1;
 
 	return b;
 }
 
+static inline void dmm_unreserve(int handle, void *proc, struct dmm_arena *arena, void *reserve)
+{
+	if (arena && dmm_arena_release(arena, reserve))
+		return;
+	dsp_unreserve(handle, proc, reserve);
+}
+
+static inline void dmm_buffer_free_data(dmm_buffer_t *b)
+{
+	if (b->mmap_size)
+		munmap(b->allocated_data, b->mmap_size);
+	else
+		free(b->allocated_data);
+	b->allocated_data = NULL;
+	b->mmap_size = 0;
+}
+
 static inline void dmm_buffer_free(dmm_buffer_t *b)
 {
 	pr_debug(NULL, "%p", b);
 	if (!b)
 		return;
+	if (b->parent) {
+		free(b);
+		return;
+	}
 	if (b->map)
 		dsp_unmap(b->handle, b->proc, b->map);
 	if (b->reserve)
-		dsp_unreserve(b->handle, b->proc, b->reserve);
-	free(b->allocated_data);
+		dmm_unreserve(b->handle, b->proc, b->arena, b->reserve);
+	dmm_buffer_free_data(b);
 	free(b);
 }
 
+/*
+ * Range tracking, opt-in. Once dirty tracking is on, begin only cleans the
+ * bytes marked dirty since the last begin; nothing is dirty when it starts.
+ * Once a read range is set, end only invalidates the bytes the CPU reads
+ * back.
+ */
+static inline void dmm_buffer_track_dirty(dmm_buffer_t *b)
+{
+	b->dirty_start = b->dirty_end = 0;
+	b->tracked = true;
+}
+
+/* a no-op unless dirty tracking is on */
+static inline void dmm_buffer_dirty(dmm_buffer_t *b, size_t offset, size_t len)
+{
+	size_t end = offset + len;
+
+	if (!b->tracked)
+		return;
+
+	if (b->dirty_start >= b->dirty_end) {
+		b->dirty_start = offset;
+		b->dirty_end = end;
+	} else {
+		if (offset < b->dirty_start)
+			b->dirty_start = offset;
+		if (end > b->dirty_end)
+			b->dirty_end = end;
+	}
+}
+
+static inline void dmm_buffer_track(dmm_buffer_t *b, size_t offset, size_t len)
+{
+	b->read_start = offset;
+	b->read_end = offset + len;
+	b->read_tracked = true;
+}
+
+/*
+ * With DSP_API 2 the cache maintenance is a DMA operation; end closes
+ * exactly the range begin opened. The DSP may write anywhere in buffers
+ * other than DMA_TO_DEVICE ones, so for those it's the whole length plus
+ * the dirty range, and the read range doesn't narrow it.
+ */
 static inline void dmm_buffer_begin(dmm_buffer_t *b, size_t len)
 {
+	size_t start = 0, end = len;
+
 	pr_debug(NULL, "%p", b);
-	if (len == 0)
-		return;
+	if (b->tracked) {
+		start = b->dirty_start;
+		if (b->dirty_end < end)
+			end = b->dirty_end;
+		b->dirty_start = b->dirty_end = 0;
+		if (end <= start)
+			start = end = 0;
+	}
 #if DSP_API < 2
+	if (end == start)
+		return;
 	if (b->dir == DMA_FROM_DEVICE)
-		dsp_invalidate(b->handle, b->proc, b->data, len);
+		dsp_invalidate(b->handle, b->proc, (char *) b->data + start, end - start);
 	else
-		dsp_flush(b->handle, b->proc, b->data, len, 1);
+		dsp_flush(b->handle, b->proc, (char *) b->data + start, end - start, 1);
 #else
 	if (b->dma_len == (size_t) -1)
 		return;
-	if (dsp_begin_dma(b->handle, b->proc, b->data, len, b->dir))
-		b->dma_len = len;
+	/* a range still open, e.g. of a buffer the CPU never read */
+	if (b->dma_len)
+		dsp_end_dma(b->handle, b->proc, (char *) b->data + b->dma_start,
+				b->dma_len, b->dir);
+	if (b->dir != DMA_TO_DEVICE) {
+		start = 0;
+		if (end < len)
+			end = len;
+	}
+	b->dma_start = start;
+	b->dma_len = 0;
+	if (end == start)
+		return;
+	if (dsp_begin_dma(b->handle, b->proc, (char *) b->data + start, end - start, b->dir))
+		b->dma_len = end - start;
 	else
 		b->dma_len = (size_t) -1;
 #endif
@@ -79,37 +173,73 @@ static inline void dmm_buffer_begin(dmm_buffer_t *b, size_t len)
 
 static inline void dmm_buffer_end(dmm_buffer_t *b, size_t len)
 {
+#if DSP_API < 2
+	size_t start = 0;
+
 	pr_debug(NULL, "%p", b);
+	if (b->read_tracked) {
+		start = b->read_start;
+		if (b->read_end < len)
+			len = b->read_end;
+		if (len <= start)
+			return;
+		len -= start;
+	}
 	if (len == 0)
 		return;
-#if DSP_API < 2
 	if (b->dir != DMA_TO_DEVICE)
-		dsp_invalidate(b->handle, b->proc, b->data, len);
+		dsp_invalidate(b->handle, b->proc, (char *) b->data + start, len);
 #else
-	if (b->dma_len == (size_t) -1)
+	pr_debug(NULL, "%p", b);
+	if (b->dma_len == (size_t) -1 || b->dma_len == 0)
 		return;
-	dsp_end_dma(b->handle, b->proc, b->data, b->dma_len, b->dir);
+	dsp_end_dma(b->handle, b->proc, (char *) b->data + b->dma_start,
+			b->dma_len, b->dir);
 	b->dma_len = 0;
 #endif
 }
 
+/* invalidates part of the buffer for the CPU, regardless of tracking */
+static inline void dmm_buffer_end_range(dmm_buffer_t *b, size_t offset, size_t len)
+{
+	pr_debug(NULL, "%p", b);
+#if DSP_API < 2
+	if (len == 0)
+		return;
+	if (b->dir != DMA_TO_DEVICE)
+		dsp_invalidate(b->handle, b->proc, (char *) b->data + offset, len);
+#else
+	/* the range begin opened covers it; it's invalidated when closed */
+	dmm_buffer_end(b, offset + len);
+#endif
+}
+
 static inline void dmm_buffer_map(dmm_buffer_t *b)
 {
 	size_t to_reserve;
 	unsigned long attr;
+	void *addr;
 
 	pr_debug(NULL, "%p", b);
 
 	if (b->map)
 		dsp_unmap(b->handle, b->proc, b->map);
 	if (b->reserve)
-		dsp_unreserve(b->handle, b->proc, b->reserve);
+		dmm_unreserve(b->handle, b->proc, b->arena, b->reserve);
 	/**
 	 * @todo What exactly do we want to do here? Shouldn't the driver
 	 * calculate this?
 	 */
 	to_reserve = ROUND_UP(b->size, PAGE_SIZE) + PAGE_SIZE;
-	dsp_reserve(b->handle, b->proc, to_reserve, &b->reserve);
+	/* room to put huge page memory on DSP MMU sections */
+	if (b->mmap_size)
+		to_reserve += DSP_SECTION_SIZE;
+	b->reserve = b->arena ? dmm_arena_alloc(b->arena, to_reserve) : NULL;
+	if (!b->reserve)
+		dsp_reserve(b->handle, b->proc, to_reserve, &b->reserve);
+	addr = b->reserve;
+	if (b->mmap_size)
+		addr = (void *) ROUND_UP((uintptr_t) addr, DSP_SECTION_SIZE);
 	switch (b->dir) {
 	case DMA_TO_DEVICE:
 		attr = DSP_IN_BUFFER; break;
@@ -120,27 +250,76 @@ static inline void dmm_buffer_map(dmm_buffer_t *b)
 	default:
 		attr = 0;
 	}
-	dsp_map(b->handle, b->proc, b->data, b->size, b->reserve, &b->map, attr);
+	dsp_map(b->handle, b->proc, b->data, b->size, addr, &b->map, attr);
+	trace(TRACE_MAP, b, 0, b->size);
 }
 
 static inline void dmm_buffer_unmap(dmm_buffer_t *b)
 {
 	pr_debug(NULL, "%p", b);
+	trace(TRACE_UNMAP, b, 0, 0);
 	if (b->map) {
 		dsp_unmap(b->handle, b->proc, b->map);
 		b->map = NULL;
 	}
 	if (b->reserve) {
-		dsp_unreserve(b->handle, b->proc, b->reserve);
+		dmm_unreserve(b->handle, b->proc, b->arena, b->reserve);
 		b->reserve = NULL;
 	}
 }
 
+/*
+ * Huge page backed memory; explicit huge pages if the system has them
+ * reserved, transparent ones otherwise.
+ */
+static inline void *dmm_buffer_alloc_huge(dmm_buffer_t *b, size_t size)
+{
+	size_t map_size = ROUND_UP(size, HUGE_PAGE_SIZE);
+	char *p, *start;
+	size_t head;
+
+#ifdef MAP_HUGETLB
+	p = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		b->mmap_size = map_size;
+		return p;
+	}
+#endif
+
+	/* over-allocate to align on a huge page, then trim */
+	p = mmap(NULL, map_size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	start = (char *) ROUND_UP((uintptr_t) p, HUGE_PAGE_SIZE);
+	head = start - p;
+	if (head)
+		munmap(p, head);
+	munmap(start + map_size, HUGE_PAGE_SIZE - head);
+
+#ifdef MADV_HUGEPAGE
+	madvise(start, map_size, MADV_HUGEPAGE);
+#endif
+	b->mmap_size = map_size;
+	return start;
+}
+
 static inline void dmm_buffer_allocate(dmm_buffer_t *b, size_t size)
 {
 	int alignment = b->dir == DMA_TO_DEVICE ? 0 : 128;
 	pr_debug(NULL, "%p", b);
-	free(b->allocated_data);
+	dmm_buffer_free_data(b);
+	/* not worth it for small buffers */
+	if (b->huge && size >= HUGE_PAGE_SIZE / 2) {
+		b->data = b->allocated_data = dmm_buffer_alloc_huge(b, size);
+		if (b->data) {
+			b->size = alignment ? ROUND_UP(size, alignment) : size;
+			b->len = size;
+			return;
+		}
+	}
 	if (alignment != 0) {
 		b->size = ROUND_UP(size, alignment);
 		if (posix_memalign(&b->allocated_data, alignment, b->size) != 0)
@@ -161,6 +340,20 @@ static inline void dmm_buffer_use(dmm_buffer_t *b, void *data, size_t size)
 	b->len = b->size = size;
 }
 
+/* a part of a mapped buffer; it's neither mapped nor freed on its own */
+static inline dmm_buffer_t *dmm_buffer_slice(dmm_buffer_t *parent, size_t offset, size_t size)
+{
+	dmm_buffer_t *b;
+
+	b = dmm_buffer_new(parent->handle, parent->proc, parent->dir);
+	b->parent = parent;
+	b->data = (char *) parent->data + offset;
+	b->map = (char *) parent->map + offset;
+	b->len = b->size = size;
+
+	return b;
+}
+
 static inline dmm_buffer_t *dmm_buffer_calloc(int handle, void *proc, size_t size, int dir)
 {
 	dmm_buffer_t *tmp;
@@ -31,9 +31,7 @@
 #include <sys/mman.h> /* for mmap */
 #endif
 
-#if DSP_API < 2
 #include <errno.h>
-#endif
 
 #define VALGRIND
 
@@ -157,12 +155,12 @@ static inline int real_ioctl(int fd, int r, void *arg)
 /* will not be needed when tidspbridge uses proper error codes */
 #define ioctl(...) (ioctl(__VA_ARGS__) < 0)
 
-int dsp_open(void)
+static int bridge_open(void)
 {
 	return open("/dev/DspBridge", O_RDWR);
 }
 
-int dsp_close(int handle)
+static int bridge_close(int handle)
 {
 	return close(handle);
 }
@@ -173,7 +171,7 @@ struct proc_attach {
 	void **ret_handle;
 };
 
-bool dsp_attach(int handle,
+static bool bridge_attach(int handle,
 		unsigned int num,
 		const void *info,
 		void **ret_handle)
@@ -191,7 +189,7 @@ struct proc_detach {
 	void *proc_handle;
 };
 
-bool dsp_detach(int handle,
+static bool bridge_detach(int handle,
 		void *proc_handle)
 {
 	struct proc_detach arg = {
@@ -208,7 +206,7 @@ struct register_notify {
 	struct dsp_notification *info;
 };
 
-bool dsp_register_notify(int handle,
+static bool bridge_register_notify(int handle,
 		void *proc_handle,
 		unsigned int event_mask,
 		unsigned int notify_type,
@@ -228,7 +226,7 @@ struct proc_start {
 	void *proc_handle;
 };
 
-bool dsp_start(int handle,
+static bool bridge_start(int handle,
 		void *proc_handle)
 {
 	struct proc_start arg = {
@@ -238,7 +236,7 @@ bool dsp_start(int handle,
 	return !ioctl(handle, PROC_START, &arg);
 }
 
-bool dsp_stop(int handle,
+static bool bridge_stop(int handle,
 		void *proc_handle)
 {
 	struct proc_start arg = {
@@ -255,7 +253,7 @@ struct proc_load {
 	char **env;
 };
 
-bool dsp_load(int handle,
+static bool bridge_load(int handle,
 		void *proc_handle,
 		int argc, char **argv,
 		char **env)
@@ -277,7 +275,7 @@ struct node_register_notify {
 	struct dsp_notification *info;
 };
 
-bool dsp_node_register_notify(int handle,
+static bool bridge_node_register_notify(int handle,
 		struct dsp_node *node,
 		unsigned int event_mask,
 		unsigned int notify_type,
@@ -300,7 +298,7 @@ struct wait_for_events {
 	unsigned int timeout;
 };
 
-bool dsp_wait_for_events(int handle,
+static bool bridge_wait_for_events(int handle,
 		struct dsp_notification **notifications,
 		unsigned int count,
 		unsigned int *ret_index,
@@ -335,7 +333,7 @@ struct enum_node {
 	unsigned int *ret_num;
 };
 
-bool dsp_enum(int handle,
+static bool bridge_enum(int handle,
 		unsigned int num,
 		struct dsp_ndb_props *info,
 		size_t info_size,
@@ -357,7 +355,7 @@ struct register_object {
 	const char *path;
 };
 
-bool dsp_register(int handle,
+static bool bridge_register(int handle,
 		const struct dsp_uuid *uuid,
 		enum dsp_dcd_object_type type,
 		const char *path)
@@ -376,7 +374,7 @@ struct unregister_object {
 	enum dsp_dcd_object_type type;
 };
 
-bool dsp_unregister(int handle,
+static bool bridge_unregister(int handle,
 		const struct dsp_uuid *uuid,
 		enum dsp_dcd_object_type type)
 {
@@ -392,7 +390,7 @@ struct node_create {
 	void *node_handle;
 };
 
-bool dsp_node_create(int handle,
+static bool bridge_node_create(int handle,
 		struct dsp_node *node)
 {
 	struct node_create arg = {
@@ -406,7 +404,7 @@ struct node_run {
 	void *node_handle;
 };
 
-bool dsp_node_run(int handle,
+static bool bridge_node_run(int handle,
 		struct dsp_node *node)
 {
 	struct node_run arg = {
@@ -421,7 +419,7 @@ struct node_terminate {
 	unsigned long *status;
 };
 
-bool dsp_node_terminate(int handle,
+static bool bridge_node_terminate(int handle,
 		struct dsp_node *node,
 		unsigned long *status)
 {
@@ -439,7 +437,7 @@ struct node_put_message {
 	unsigned int timeout;
 };
 
-bool dsp_node_put_message(int handle,
+static bool bridge_node_put_message(int handle,
 		struct dsp_node *node,
 		const struct dsp_msg *message,
 		unsigned int timeout)
@@ -459,7 +457,7 @@ struct node_get_message {
 	unsigned int timeout;
 };
 
-bool dsp_node_get_message(int handle,
+static bool bridge_node_get_message(int handle,
 		struct dsp_node *node,
 		struct dsp_msg *message,
 		unsigned int timeout)
@@ -480,7 +478,7 @@ struct node_delete {
 	void *node_handle;
 };
 
-static inline bool dsp_node_delete(int handle,
+static inline bool bridge_node_delete(int handle,
 		struct dsp_node *node)
 {
 	struct node_delete arg = {
@@ -497,7 +495,7 @@ struct node_get_attr {
 	unsigned int attr_size;
 };
 
-bool dsp_node_get_attr(int handle,
+static bool bridge_node_get_attr(int handle,
 		struct dsp_node *node,
 		struct dsp_node_attr *attr,
 		size_t attr_size)
@@ -612,7 +610,7 @@ static inline bool allocate_segments(int handle,
 	if (!get_cmm_info(handle, proc_handle, &cmm_info))
 		return false;
 
-	if (!dsp_node_get_attr(handle, node, &attr, sizeof(attr)))
+	if (!bridge_node_get_attr(handle, node, &attr, sizeof(attr)))
 		return false;
 
 	node_type = attr.info.props.ntype;
@@ -687,7 +685,7 @@ struct node_allocate {
 	void **ret_node;
 };
 
-bool dsp_node_allocate(int handle,
+static bool bridge_node_allocate(int handle,
 		void *proc_handle,
 		const struct dsp_uuid *node_uuid,
 		const void *cb_data,
@@ -749,7 +747,7 @@ bool dsp_node_allocate(int handle,
 
 #ifdef ALLOCATE_SM
 	if (!allocate_segments(handle, proc_handle, node)) {
-		dsp_node_delete(handle, node);
+		bridge_node_delete(handle, node);
 		free(node->heap);
 		free(node);
 		return false;
@@ -770,7 +768,7 @@ struct node_connect {
 	void *params;
 };
 
-bool dsp_node_connect(int handle,
+static bool bridge_node_connect(int handle,
 		struct dsp_node *node,
 		unsigned int stream,
 		struct dsp_node *other_node,
@@ -790,13 +788,13 @@ bool dsp_node_connect(int handle,
 	return !ioctl(handle, NODE_CONNECT, &arg);
 }
 
-bool dsp_node_free(int handle,
+static bool bridge_node_free(int handle,
 		struct dsp_node *node)
 {
 #ifdef ALLOCATE_SM
 	munmap(node->msgbuf_addr, node->msgbuf_size);
 #endif
-	dsp_node_delete(handle, node);
+	bridge_node_delete(handle, node);
 	free(node->heap);
 	free(node);
 
@@ -809,7 +807,7 @@ struct reserve_mem {
 	void **addr;
 };
 
-bool dsp_reserve(int handle,
+static bool bridge_reserve(int handle,
 		void *proc_handle,
 		unsigned long size,
 		void **addr)
@@ -829,7 +827,7 @@ struct unreserve_mem {
 	void *addr;
 };
 
-bool dsp_unreserve(int handle,
+static bool bridge_unreserve(int handle,
 		void *proc_handle,
 		void *addr)
 {
@@ -850,7 +848,7 @@ struct map_mem {
 	unsigned long attr;
 };
 
-bool dsp_map(int handle,
+static bool bridge_map(int handle,
 		void *proc_handle,
 		void *mpu_addr,
 		unsigned long size,
@@ -876,7 +874,7 @@ struct unmap_mem {
 	void *map_addr;
 };
 
-bool dsp_unmap(int handle,
+static bool bridge_unmap(int handle,
 		void *proc_handle,
 		void *map_addr)
 {
@@ -895,7 +893,7 @@ struct flush_mem {
 	unsigned long flags;
 };
 
-bool dsp_flush(int handle,
+static bool bridge_flush(int handle,
 		void *proc_handle,
 		void *mpu_addr,
 		unsigned long size,
@@ -917,7 +915,7 @@ struct invalidate_mem {
 	unsigned long size;
 };
 
-bool dsp_invalidate(int handle,
+static bool bridge_invalidate(int handle,
 		void *proc_handle,
 		void *mpu_addr,
 		unsigned long size)
@@ -938,7 +936,7 @@ struct dma_op {
 	unsigned long dir;
 };
 
-bool dsp_begin_dma(int handle,
+static bool bridge_begin_dma(int handle,
 		void *proc_handle,
 		void *mpu_addr,
 		unsigned long size,
@@ -954,7 +952,7 @@ bool dsp_begin_dma(int handle,
 	return !ioctl(handle, PROC_BEGINDMA, &arg);
 }
 
-bool dsp_end_dma(int handle,
+static bool bridge_end_dma(int handle,
 		void *proc_handle,
 		void *mpu_addr,
 		unsigned long size,
@@ -977,9 +975,9 @@ struct proc_get_info {
 	unsigned size;
 };
 
-bool dsp_proc_get_info(int handle,
+static bool bridge_proc_get_info(int handle,
 		void *proc_handle,
-		unsigned type,
+		enum dsp_resource type,
 		struct dsp_info *info,
 		unsigned size)
 {
@@ -1001,7 +999,7 @@ struct enum_nodes {
 	unsigned *allocated;
 };
 
-bool dsp_enum_nodes(int handle,
+static bool bridge_enum_nodes(int handle,
 		void *proc_handle,
 		void **node_table,
 		unsigned node_table_size,
@@ -1019,6 +1017,331 @@ bool dsp_enum_nodes(int handle,
 	return !ioctl(handle, PROC_ENUMNODE, &arg);
 }
 
+static const struct dsp_backend bridge_backend = {
+	.name = "bridge",
+	.open = bridge_open,
+	.close = bridge_close,
+	.attach = bridge_attach,
+	.detach = bridge_detach,
+	.start = bridge_start,
+	.stop = bridge_stop,
+	.load = bridge_load,
+	.node_allocate = bridge_node_allocate,
+	.node_free = bridge_node_free,
+	.node_connect = bridge_node_connect,
+	.node_create = bridge_node_create,
+	.node_run = bridge_node_run,
+	.node_terminate = bridge_node_terminate,
+	.node_put_message = bridge_node_put_message,
+	.node_get_message = bridge_node_get_message,
+#ifdef ALLOCATE_SM
+	.node_get_attr = bridge_node_get_attr,
+#endif
+	.reserve = bridge_reserve,
+	.unreserve = bridge_unreserve,
+	.map = bridge_map,
+	.unmap = bridge_unmap,
+	.flush = bridge_flush,
+	.invalidate = bridge_invalidate,
+	.begin_dma = bridge_begin_dma,
+	.end_dma = bridge_end_dma,
+	.register_notify = bridge_register_notify,
+	.node_register_notify = bridge_node_register_notify,
+	.wait_for_events = bridge_wait_for_events,
+	.enumerate = bridge_enum,
+	.reg = bridge_register,
+	.unreg = bridge_unregister,
+	.proc_get_info = bridge_proc_get_info,
+	.enum_nodes = bridge_enum_nodes,
+};
+
+static const struct dsp_backend *backend = &bridge_backend;
+static bool backend_set;
+
+void dsp_set_backend(const struct dsp_backend *b)
+{
+	backend = b ? b : &bridge_backend;
+	backend_set = true;
+}
+
+const struct dsp_backend *dsp_get_backend(void)
+{
+	return backend;
+}
+
+/* not every backend implements everything */
+#define backend_call(op, ...) \
+	(backend->op ? backend->op(__VA_ARGS__) : (errno = ENOSYS, false))
+
+int dsp_open(void)
+{
+	if (!backend_set) {
+		const char *sim = getenv("TIDSP_SIM");
+		if (sim) {
+			dsp_sim_set_latency(strtoul(sim, NULL, 0));
+			backend = &dsp_sim_backend;
+		}
+		backend_set = true;
+	}
+
+	return backend->open();
+}
+
+int dsp_close(int handle)
+{
+	return backend->close(handle);
+}
+
+bool dsp_attach(int handle,
+		unsigned int num,
+		const void *info,
+		void **ret_handle)
+{
+	return backend_call(attach, handle, num, info, ret_handle);
+}
+
+bool dsp_detach(int handle,
+		void *proc_handle)
+{
+	return backend_call(detach, handle, proc_handle);
+}
+
+bool dsp_start(int handle,
+		void *proc_handle)
+{
+	return backend_call(start, handle, proc_handle);
+}
+
+bool dsp_stop(int handle,
+		void *proc_handle)
+{
+	return backend_call(stop, handle, proc_handle);
+}
+
+bool dsp_load(int handle,
+		void *proc_handle,
+		int argc, char **argv,
+		char **env)
+{
+	return backend_call(load, handle, proc_handle, argc, argv, env);
+}
+
+bool dsp_node_allocate(int handle,
+		void *proc_handle,
+		const struct dsp_uuid *node_uuid,
+		const void *cb_data,
+		struct dsp_node_attr_in *attrs,
+		struct dsp_node **ret_node)
+{
+	return backend_call(node_allocate, handle, proc_handle, node_uuid, cb_data, attrs, ret_node);
+}
+
+bool dsp_node_free(int handle,
+		struct dsp_node *node)
+{
+	return backend_call(node_free, handle, node);
+}
+
+bool dsp_node_connect(int handle,
+		struct dsp_node *node,
+		unsigned int stream,
+		struct dsp_node *other_node,
+		unsigned int other_stream,
+		struct dsp_stream_attr *attrs,
+		void *params)
+{
+	return backend_call(node_connect, handle, node, stream,
+			other_node, other_stream, attrs, params);
+}
+
+bool dsp_node_create(int handle,
+		struct dsp_node *node)
+{
+	return backend_call(node_create, handle, node);
+}
+
+bool dsp_node_run(int handle,
+		struct dsp_node *node)
+{
+	return backend_call(node_run, handle, node);
+}
+
+bool dsp_node_terminate(int handle,
+		struct dsp_node *node,
+		unsigned long *status)
+{
+	return backend_call(node_terminate, handle, node, status);
+}
+
+bool dsp_node_put_message(int handle,
+		struct dsp_node *node,
+		const struct dsp_msg *message,
+		unsigned int timeout)
+{
+	return backend_call(node_put_message, handle, node, message, timeout);
+}
+
+bool dsp_node_get_message(int handle,
+		struct dsp_node *node,
+		struct dsp_msg *message,
+		unsigned int timeout)
+{
+	return backend_call(node_get_message, handle, node, message, timeout);
+}
+
+bool dsp_node_get_attr(int handle,
+		struct dsp_node *node,
+		struct dsp_node_attr *attr,
+		size_t attr_size)
+{
+	return backend_call(node_get_attr, handle, node, attr, attr_size);
+}
+
+bool dsp_reserve(int handle,
+		void *proc_handle,
+		unsigned long size,
+		void **addr)
+{
+	return backend_call(reserve, handle, proc_handle, size, addr);
+}
+
+bool dsp_unreserve(int handle,
+		void *proc_handle,
+		void *addr)
+{
+	return backend_call(unreserve, handle, proc_handle, addr);
+}
+
+bool dsp_map(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		void *req_addr,
+		void *ret_map_addr,
+		unsigned long attr)
+{
+	return backend_call(map, handle, proc_handle, mpu_addr, size, req_addr, ret_map_addr, attr);
+}
+
+bool dsp_unmap(int handle,
+		void *proc_handle,
+		void *map_addr)
+{
+	return backend_call(unmap, handle, proc_handle, map_addr);
+}
+
+bool dsp_flush(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		unsigned long flags)
+{
+	return backend_call(flush, handle, proc_handle, mpu_addr, size, flags);
+}
+
+bool dsp_invalidate(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size)
+{
+	return backend_call(invalidate, handle, proc_handle, mpu_addr, size);
+}
+
+bool dsp_begin_dma(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		unsigned long dir)
+{
+	return backend_call(begin_dma, handle, proc_handle, mpu_addr, size, dir);
+}
+
+bool dsp_end_dma(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		unsigned long dir)
+{
+	return backend_call(end_dma, handle, proc_handle, mpu_addr, size, dir);
+}
+
+bool dsp_register_notify(int handle,
+		void *proc_handle,
+		unsigned int event_mask,
+		unsigned int notify_type,
+		struct dsp_notification *info)
+{
+	return backend_call(register_notify, handle, proc_handle, event_mask, notify_type, info);
+}
+
+bool dsp_node_register_notify(int handle,
+		struct dsp_node *node,
+		unsigned int event_mask,
+		unsigned int notify_type,
+		struct dsp_notification *info)
+{
+	return backend_call(node_register_notify, handle, node, event_mask, notify_type, info);
+}
+
+bool dsp_wait_for_events(int handle,
+		struct dsp_notification **notifications,
+		unsigned int count,
+		unsigned int *ret_index,
+		unsigned int timeout)
+{
+	return backend_call(wait_for_events, handle, notifications, count, ret_index, timeout);
+}
+
+bool dsp_notify(int handle,
+		struct dsp_notification *info)
+{
+	return backend_call(notify, handle, info);
+}
+
+bool dsp_enum(int handle,
+		unsigned int num,
+		struct dsp_ndb_props *info,
+		size_t info_size,
+		unsigned int *ret_num)
+{
+	return backend_call(enumerate, handle, num, info, info_size, ret_num);
+}
+
+bool dsp_register(int handle,
+		const struct dsp_uuid *uuid,
+		enum dsp_dcd_object_type type,
+		const char *path)
+{
+	return backend_call(reg, handle, uuid, type, path);
+}
+
+bool dsp_unregister(int handle,
+		const struct dsp_uuid *uuid,
+		enum dsp_dcd_object_type type)
+{
+	return backend_call(unreg, handle, uuid, type);
+}
+
+bool dsp_proc_get_info(int handle,
+		void *proc_handle,
+		enum dsp_resource type,
+		struct dsp_info *info,
+		unsigned size)
+{
+	return backend_call(proc_get_info, handle, proc_handle, type, info, size);
+}
+
+bool dsp_enum_nodes(int handle,
+		void *proc_handle,
+		void **node_table,
+		unsigned node_table_size,
+		unsigned *num_nodes,
+		unsigned *allocated)
+{
+	return backend_call(enum_nodes, handle, proc_handle, node_table,
+			node_table_size, num_nodes, allocated);
+}
+
 struct stream_attr {
 	void *event;
 	char *name;
@@ -360,6 +360,13 @@ bool dsp_wait_for_events(int handle,
 		unsigned int *ret_index,
 		unsigned int timeout);
 
+/*
+ * Signals a notification from the MPU side, waking a dsp_wait_for_events()
+ * on it; the kernel bridge can't, it fails with ENOSYS.
+ */
+bool dsp_notify(int handle,
+		struct dsp_notification *info);
+
 bool dsp_enum(int handle,
 		unsigned int num,
 		struct dsp_ndb_props *info,
@@ -453,4 +460,79 @@ bool dsp_stream_free_buffers(int handle,
 		unsigned char **buff,
 		unsigned int num_buf);
 
+struct dsp_backend {
+	const char *name;
+
+	int (*open)(void);
+	int (*close)(int handle);
+
+	bool (*attach)(int handle, unsigned int num, const void *info, void **ret_handle);
+	bool (*detach)(int handle, void *proc_handle);
+	bool (*start)(int handle, void *proc_handle);
+	bool (*stop)(int handle, void *proc_handle);
+	bool (*load)(int handle, void *proc_handle, int argc, char **argv, char **env);
+
+	bool (*node_allocate)(int handle, void *proc_handle,
+			const struct dsp_uuid *node_uuid, const void *cb_data,
+			struct dsp_node_attr_in *attrs, struct dsp_node **ret_node);
+	bool (*node_free)(int handle, struct dsp_node *node);
+	bool (*node_connect)(int handle, struct dsp_node *node, unsigned int stream,
+			struct dsp_node *other_node, unsigned int other_stream,
+			struct dsp_stream_attr *attrs, void *params);
+	bool (*node_create)(int handle, struct dsp_node *node);
+	bool (*node_run)(int handle, struct dsp_node *node);
+	bool (*node_terminate)(int handle, struct dsp_node *node, unsigned long *status);
+	bool (*node_put_message)(int handle, struct dsp_node *node,
+			const struct dsp_msg *message, unsigned int timeout);
+	bool (*node_get_message)(int handle, struct dsp_node *node,
+			struct dsp_msg *message, unsigned int timeout);
+	bool (*node_get_attr)(int handle, struct dsp_node *node,
+			struct dsp_node_attr *attr, size_t attr_size);
+
+	bool (*reserve)(int handle, void *proc_handle, unsigned long size, void **addr);
+	bool (*unreserve)(int handle, void *proc_handle, void *addr);
+	bool (*map)(int handle, void *proc_handle, void *mpu_addr, unsigned long size,
+			void *req_addr, void *ret_map_addr, unsigned long attr);
+	bool (*unmap)(int handle, void *proc_handle, void *map_addr);
+	bool (*flush)(int handle, void *proc_handle, void *mpu_addr,
+			unsigned long size, unsigned long flags);
+	bool (*invalidate)(int handle, void *proc_handle, void *mpu_addr, unsigned long size);
+	bool (*begin_dma)(int handle, void *proc_handle, void *mpu_addr,
+			unsigned long size, unsigned long dir);
+	bool (*end_dma)(int handle, void *proc_handle, void *mpu_addr,
+			unsigned long size, unsigned long dir);
+
+	bool (*register_notify)(int handle, void *proc_handle, unsigned int event_mask,
+			unsigned int notify_type, struct dsp_notification *info);
+	bool (*node_register_notify)(int handle, struct dsp_node *node, unsigned int event_mask,
+			unsigned int notify_type, struct dsp_notification *info);
+	bool (*wait_for_events)(int handle, struct dsp_notification **notifications,
+			unsigned int count, unsigned int *ret_index, unsigned int timeout);
+	bool (*notify)(int handle, struct dsp_notification *info);
+
+	bool (*enumerate)(int handle, unsigned int num, struct dsp_ndb_props *info,
+			size_t info_size, unsigned int *ret_num);
+	bool (*reg)(int handle, const struct dsp_uuid *uuid,
+			enum dsp_dcd_object_type type, const char *path);
+	bool (*unreg)(int handle, const struct dsp_uuid *uuid, enum dsp_dcd_object_type type);
+	bool (*proc_get_info)(int handle, void *proc_handle, enum dsp_resource type,
+			struct dsp_info *info, unsigned size);
+	bool (*enum_nodes)(int handle, void *proc_handle, void **node_table,
+			unsigned node_table_size, unsigned *num_nodes, unsigned *allocated);
+};
+
+/*
+ * Replaces the backend used by every dsp_* call above (streams excluded,
+ * they always go to the kernel). Must be done before the first dsp_open().
+ * The default is the /dev/DspBridge ioctl backend, unless TIDSP_SIM is set
+ * in the environment, in which case the simulator is used with TIDSP_SIM
+ * as the per-frame latency in microseconds.
+ */
+void dsp_set_backend(const struct dsp_backend *backend);
+const struct dsp_backend *dsp_get_backend(void);
+
+extern const struct dsp_backend dsp_sim_backend;
+
+void dsp_sim_set_latency(unsigned usec);
+
 #endif /* DSP_BRIDGE_H */
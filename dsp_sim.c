@@ -0,0 +1,736 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * In-process DSP simulator.
+ *
+ * Implements enough of the bridge for libtidsp to run without hardware: a
+ * fake DSP virtual address space, node message queues and notifications,
+ * and a thread per node that speaks the usn protocol; 0x0100 play, 0x0200
+ * stop, 0x0400 alg ctrl, 0x0500 flush and 0x06xx buffers. While playing, a
+ * node takes one buffer from port 0 and one from port 1, waits the
+ * configured latency, and returns both, the output one filled.
+ */
+
+#include "dsp_bridge.h"
+#include "usn.h"
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_QUEUE 64
+#define SIM_PORTS 2
+#define SIM_PAGE 0x1000
+#define SIM_VA_START 0x20000000UL
+#define SIM_VA_END 0xf0000000UL
+
+struct sim_event {
+	struct sim_event *next;
+	int owner;
+	bool signaled;
+};
+
+struct sim_queue {
+	uint32_t items[SIM_QUEUE][3];
+	unsigned head, count;
+};
+
+struct sim_node {
+	pthread_t thread;
+	bool running, playing, quit;
+	struct sim_queue in, out;
+	struct sim_queue pending[SIM_PORTS];
+	struct sim_event ready;
+	unsigned latency;
+};
+
+struct sim_region {
+	unsigned long addr;
+	unsigned long size;
+};
+
+struct sim_mapping {
+	unsigned long addr;
+	unsigned long size;
+	void *mpu_addr;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static unsigned latency;
+static struct sim_event *events;
+static struct sim_region *regions;
+static unsigned nr_regions;
+static struct sim_mapping *mappings;
+static unsigned nr_mappings;
+static int proc;
+
+void dsp_sim_set_latency(unsigned usec)
+{
+	latency = usec;
+}
+
+static inline bool queue_push(struct sim_queue *q, uint32_t a, uint32_t b, uint32_t c)
+{
+	uint32_t *item;
+
+	if (q->count >= SIM_QUEUE)
+		return false;
+	item = q->items[(q->head + q->count++) % SIM_QUEUE];
+	item[0] = a;
+	item[1] = b;
+	item[2] = c;
+	return true;
+}
+
+static inline bool queue_pop(struct sim_queue *q, uint32_t *a, uint32_t *b, uint32_t *c)
+{
+	uint32_t *item;
+
+	if (!q->count)
+		return false;
+	item = q->items[q->head];
+	q->head = (q->head + 1) % SIM_QUEUE;
+	q->count--;
+	if (a)
+		*a = item[0];
+	if (b)
+		*b = item[1];
+	if (c)
+		*c = item[2];
+	return true;
+}
+
+static struct sim_event *event_new(int owner)
+{
+	struct sim_event *e;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->owner = owner;
+	e->next = events;
+	events = e;
+	return e;
+}
+
+/* translate a DSP address back to the mpu one; lock must be held */
+static void *translate(uint32_t addr)
+{
+	unsigned i;
+
+	for (i = 0; i < nr_mappings; i++) {
+		struct sim_mapping *m = &mappings[i];
+		if (addr >= m->addr && addr < m->addr + m->size)
+			return (char *) m->mpu_addr + (addr - m->addr);
+	}
+	return NULL;
+}
+
+static struct sim_region *find_region(unsigned long addr)
+{
+	unsigned i;
+
+	for (i = 0; i < nr_regions; i++)
+		if (addr >= regions[i].addr && addr < regions[i].addr + regions[i].size)
+			return &regions[i];
+	return NULL;
+}
+
+static void post(struct sim_node *node, uint32_t cmd, uint32_t arg_1, uint32_t arg_2)
+{
+	while (!queue_push(&node->out, cmd, arg_1, arg_2) && !node->quit)
+		pthread_cond_wait(&cond, &lock);
+	node->ready.signaled = true;
+	pthread_cond_broadcast(&cond);
+}
+
+static void return_buffer(struct sim_node *node, unsigned port, uint32_t comm_addr, bool fill)
+{
+	usn_comm_t *comm;
+
+	comm = translate(comm_addr);
+	if (comm && fill)
+		comm->buffer_len = comm->buffer_size;
+
+	post(node, 0x0600 | port, comm_addr, 0);
+}
+
+static void return_all(struct sim_node *node)
+{
+	unsigned port;
+	uint32_t addr;
+
+	for (port = 0; port < SIM_PORTS; port++)
+		while (queue_pop(&node->pending[port], &addr, NULL, NULL))
+			return_buffer(node, port, addr, false);
+}
+
+static void handle_command(struct sim_node *node, uint32_t cmd, uint32_t arg_1, uint32_t arg_2)
+{
+	switch (cmd & 0xffffff00) {
+	case 0x0600: {
+		unsigned port = cmd & 0xff;
+		if (port >= SIM_PORTS || !queue_push(&node->pending[port], arg_1, 0, 0))
+			post(node, 0x0e00, 1, 0x0f00);
+		break;
+	}
+	case 0x0100:
+		node->playing = true;
+		break;
+	case 0x0200:
+		node->playing = false;
+		return_all(node);
+		post(node, 0x0200, 0, 0);
+		break;
+	case 0x0500:
+		return_all(node);
+		post(node, 0x0500, 0, 0);
+		break;
+	case 0x0400:
+		post(node, 0x0400, arg_1, arg_2);
+		break;
+	default:
+		break;
+	}
+}
+
+static void *node_thread(void *data)
+{
+	struct sim_node *node = data;
+
+	pthread_mutex_lock(&lock);
+	while (!node->quit) {
+		uint32_t cmd, arg_1, arg_2;
+
+		if (queue_pop(&node->in, &cmd, &arg_1, &arg_2)) {
+			pthread_cond_broadcast(&cond);
+			handle_command(node, cmd, arg_1, arg_2);
+			continue;
+		}
+
+		if (node->playing && node->pending[0].count && node->pending[1].count) {
+			uint32_t in, out;
+
+			queue_pop(&node->pending[0], &in, NULL, NULL);
+			queue_pop(&node->pending[1], &out, NULL, NULL);
+
+			if (node->latency) {
+				struct timespec ts = {
+					.tv_sec = node->latency / 1000000,
+					.tv_nsec = (node->latency % 1000000) * 1000,
+				};
+				pthread_mutex_unlock(&lock);
+				nanosleep(&ts, NULL);
+				pthread_mutex_lock(&lock);
+			}
+
+			return_buffer(node, 0, in, false);
+			return_buffer(node, 1, out, true);
+			continue;
+		}
+
+		pthread_cond_wait(&cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static bool wait_until(const struct timespec *deadline)
+{
+	if (!deadline) {
+		pthread_cond_wait(&cond, &lock);
+		return true;
+	}
+	return pthread_cond_timedwait(&cond, &lock, deadline) != ETIMEDOUT;
+}
+
+static struct timespec *get_deadline(struct timespec *ts, unsigned int timeout)
+{
+	if (timeout == (unsigned int) -1)
+		return NULL;
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+	return ts;
+}
+
+static int sim_open(void)
+{
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+static int sim_close(int handle)
+{
+	struct sim_event **p;
+
+	pthread_mutex_lock(&lock);
+	p = &events;
+	while (*p) {
+		struct sim_event *e = *p;
+		if (e->owner == handle) {
+			*p = e->next;
+			free(e);
+		} else {
+			p = &e->next;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return close(handle);
+}
+
+static bool sim_attach(int handle,
+		unsigned int num,
+		const void *info,
+		void **ret_handle)
+{
+	*ret_handle = &proc;
+	return true;
+}
+
+static bool sim_detach(int handle,
+		void *proc_handle)
+{
+	return true;
+}
+
+static bool sim_node_allocate(int handle,
+		void *proc_handle,
+		const struct dsp_uuid *node_uuid,
+		const void *cb_data,
+		struct dsp_node_attr_in *attrs,
+		struct dsp_node **ret_node)
+{
+	struct dsp_node *node;
+	struct sim_node *sim;
+
+	node = calloc(1, sizeof(*node));
+	sim = calloc(1, sizeof(*sim));
+	if (!node || !sim) {
+		free(node);
+		free(sim);
+		errno = ENOMEM;
+		return false;
+	}
+
+	sim->latency = latency;
+	node->handle = sim;
+	*ret_node = node;
+
+	return true;
+}
+
+static bool sim_node_create(int handle,
+		struct dsp_node *node)
+{
+	return true;
+}
+
+static bool sim_node_run(int handle,
+		struct dsp_node *node)
+{
+	struct sim_node *sim = node->handle;
+
+	if (sim->running)
+		return true;
+	if (pthread_create(&sim->thread, NULL, node_thread, sim) != 0)
+		return false;
+	sim->running = true;
+
+	return true;
+}
+
+static bool sim_node_terminate(int handle,
+		struct dsp_node *node,
+		unsigned long *status)
+{
+	struct sim_node *sim = node->handle;
+
+	if (!sim->running)
+		return true;
+
+	pthread_mutex_lock(&lock);
+	sim->quit = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(sim->thread, NULL);
+	sim->running = false;
+	if (status)
+		*status = 0;
+
+	return true;
+}
+
+static bool sim_node_free(int handle,
+		struct dsp_node *node)
+{
+	sim_node_terminate(handle, node, NULL);
+	free(node->handle);
+	free(node);
+
+	return true;
+}
+
+static bool sim_node_put_message(int handle,
+		struct dsp_node *node,
+		const struct dsp_msg *message,
+		unsigned int timeout)
+{
+	struct sim_node *sim = node->handle;
+	struct timespec ts, *deadline;
+	bool ret = true;
+
+	deadline = get_deadline(&ts, timeout);
+
+	pthread_mutex_lock(&lock);
+	while (!queue_push(&sim->in, message->cmd, message->arg_1, message->arg_2)) {
+		if (!timeout || !wait_until(deadline)) {
+			errno = ETIME;
+			ret = false;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+static bool sim_node_get_message(int handle,
+		struct dsp_node *node,
+		struct dsp_msg *message,
+		unsigned int timeout)
+{
+	struct sim_node *sim = node->handle;
+	struct timespec ts, *deadline;
+	bool ret = true;
+
+	deadline = get_deadline(&ts, timeout);
+
+	pthread_mutex_lock(&lock);
+	while (!queue_pop(&sim->out, &message->cmd, &message->arg_1, &message->arg_2)) {
+		if (!timeout || !wait_until(deadline)) {
+			errno = ETIME;
+			ret = false;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+static bool sim_reserve(int handle,
+		void *proc_handle,
+		unsigned long size,
+		void **addr)
+{
+	unsigned long start = SIM_VA_START;
+	struct sim_region *tmp;
+	unsigned i;
+
+	size = (size + SIM_PAGE - 1) & ~(SIM_PAGE - 1);
+
+	pthread_mutex_lock(&lock);
+
+	/* regions are sorted; first fit */
+	for (i = 0; i < nr_regions; i++) {
+		if (regions[i].addr - start >= size)
+			break;
+		start = regions[i].addr + regions[i].size;
+	}
+
+	if (start + size > SIM_VA_END)
+		goto nomem;
+
+	tmp = realloc(regions, (nr_regions + 1) * sizeof(*regions));
+	if (!tmp)
+		goto nomem;
+	regions = tmp;
+
+	memmove(&regions[i + 1], &regions[i], (nr_regions - i) * sizeof(*regions));
+	memset(&regions[i], 0, sizeof(*regions));
+	regions[i].addr = start;
+	regions[i].size = size;
+	nr_regions++;
+
+	pthread_mutex_unlock(&lock);
+
+	*addr = (void *) start;
+	return true;
+
+nomem:
+	pthread_mutex_unlock(&lock);
+	errno = ENOMEM;
+	return false;
+}
+
+static bool sim_unreserve(int handle,
+		void *proc_handle,
+		void *addr)
+{
+	struct sim_region *r;
+
+	pthread_mutex_lock(&lock);
+	r = find_region((unsigned long) addr);
+	if (r && r->addr != (unsigned long) addr)
+		r = NULL;
+	if (r) {
+		nr_regions--;
+		memmove(r, r + 1, (nr_regions - (r - regions)) * sizeof(*regions));
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!r)
+		errno = EINVAL;
+	return r != NULL;
+}
+
+static bool sim_map(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		void *req_addr,
+		void *ret_map_addr,
+		unsigned long attr)
+{
+	unsigned long addr = (unsigned long) req_addr;
+	unsigned long offset = (unsigned long) mpu_addr & (SIM_PAGE - 1);
+	struct sim_mapping *tmp;
+	struct sim_region *r;
+
+	pthread_mutex_lock(&lock);
+	r = find_region(addr);
+	if (!r || addr + offset + size > r->addr + r->size)
+		goto inval;
+
+	tmp = realloc(mappings, (nr_mappings + 1) * sizeof(*mappings));
+	if (!tmp)
+		goto inval;
+	mappings = tmp;
+
+	/* like the bridge, keep the offset within the page */
+	tmp = &mappings[nr_mappings++];
+	tmp->addr = addr += offset;
+	tmp->size = size;
+	tmp->mpu_addr = mpu_addr;
+	pthread_mutex_unlock(&lock);
+
+	*(void **) ret_map_addr = (void *) addr;
+	return true;
+
+inval:
+	pthread_mutex_unlock(&lock);
+	errno = EINVAL;
+	return false;
+}
+
+static bool sim_unmap(int handle,
+		void *proc_handle,
+		void *map_addr)
+{
+	bool found = false;
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < nr_mappings; i++) {
+		if (mappings[i].addr == (unsigned long) map_addr) {
+			mappings[i] = mappings[--nr_mappings];
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (!found)
+		errno = EINVAL;
+	return found;
+}
+
+static bool sim_flush(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		unsigned long flags)
+{
+	return true;
+}
+
+static bool sim_invalidate(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size)
+{
+	return true;
+}
+
+static bool sim_dma(int handle,
+		void *proc_handle,
+		void *mpu_addr,
+		unsigned long size,
+		unsigned long dir)
+{
+	return true;
+}
+
+static bool sim_register_notify(int handle,
+		void *proc_handle,
+		unsigned int event_mask,
+		unsigned int notify_type,
+		struct dsp_notification *info)
+{
+	pthread_mutex_lock(&lock);
+	info->handle = event_new(handle);
+	pthread_mutex_unlock(&lock);
+
+	return info->handle != NULL;
+}
+
+static bool sim_node_register_notify(int handle,
+		struct dsp_node *node,
+		unsigned int event_mask,
+		unsigned int notify_type,
+		struct dsp_notification *info)
+{
+	struct sim_node *sim = node->handle;
+
+	if (!(event_mask & DSP_NODEMESSAGEREADY)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	pthread_mutex_lock(&lock);
+	info->handle = &sim->ready;
+	sim->ready.signaled = sim->out.count > 0;
+	pthread_mutex_unlock(&lock);
+
+	return true;
+}
+
+static bool sim_wait_for_events(int handle,
+		struct dsp_notification **notifications,
+		unsigned int count,
+		unsigned int *ret_index,
+		unsigned int timeout)
+{
+	struct timespec ts, *deadline;
+
+	deadline = get_deadline(&ts, timeout);
+
+	pthread_mutex_lock(&lock);
+	while (true) {
+		unsigned i;
+
+		for (i = 0; i < count; i++) {
+			struct sim_event *e = notifications[i]->handle;
+			if (e && e->signaled) {
+				e->signaled = false;
+				*ret_index = i;
+				pthread_mutex_unlock(&lock);
+				return true;
+			}
+		}
+
+		if (!timeout || !wait_until(deadline))
+			break;
+	}
+	pthread_mutex_unlock(&lock);
+
+	errno = ETIME;
+	return false;
+}
+
+static bool sim_notify(int handle,
+		struct dsp_notification *info)
+{
+	struct sim_event *e = info->handle;
+
+	if (!e) {
+		errno = EINVAL;
+		return false;
+	}
+
+	pthread_mutex_lock(&lock);
+	e->signaled = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return true;
+}
+
+static bool sim_register(int handle,
+		const struct dsp_uuid *uuid,
+		enum dsp_dcd_object_type type,
+		const char *path)
+{
+	return true;
+}
+
+static bool sim_unregister(int handle,
+		const struct dsp_uuid *uuid,
+		enum dsp_dcd_object_type type)
+{
+	return true;
+}
+
+static bool sim_proc_get_info(int handle,
+		void *proc_handle,
+		enum dsp_resource type,
+		struct dsp_info *info,
+		unsigned size)
+{
+	memset(info, 0, size);
+	info->cb = size;
+	info->type = type;
+	return true;
+}
+
+const struct dsp_backend dsp_sim_backend = {
+	.name = "sim",
+	.open = sim_open,
+	.close = sim_close,
+	.attach = sim_attach,
+	.detach = sim_detach,
+	.node_allocate = sim_node_allocate,
+	.node_free = sim_node_free,
+	.node_create = sim_node_create,
+	.node_run = sim_node_run,
+	.node_terminate = sim_node_terminate,
+	.node_put_message = sim_node_put_message,
+	.node_get_message = sim_node_get_message,
+	.reserve = sim_reserve,
+	.unreserve = sim_unreserve,
+	.map = sim_map,
+	.unmap = sim_unmap,
+	.flush = sim_flush,
+	.invalidate = sim_invalidate,
+	.begin_dma = sim_dma,
+	.end_dma = sim_dma,
+	.register_notify = sim_register_notify,
+	.node_register_notify = sim_node_register_notify,
+	.wait_for_events = sim_wait_for_events,
+	.notify = sim_notify,
+	.reg = sim_register,
+	.unreg = sim_unregister,
+	.proc_get_info = sim_proc_get_info,
+};
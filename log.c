@@ -13,6 +13,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "tidsp.h"
 
 #define SYSLOG
 
@@ -20,6 +25,39 @@
 #include <syslog.h>
 #endif
 
+#define LOG_RING 256
+#define LOG_MESSAGE_SIZE 200
+
+#if defined(DEBUG)
+unsigned int pr_level = 4;
+#elif defined(DEVEL)
+unsigned int pr_level = 3;
+#else
+unsigned int pr_level = 2;
+#endif
+
+static td_log_handler_t log_handler;
+static void *log_handler_data;
+
+void td_set_log_level(unsigned level)
+{
+	pr_level = level;
+}
+
+void td_set_log_handler(td_log_handler_t handler, void *data)
+{
+	log_handler = handler;
+	log_handler_data = data;
+}
+
+static void __attribute__((constructor)) log_init(void)
+{
+	const char *level = getenv("TIDSP_LOG_LEVEL");
+
+	if (level)
+		pr_level = strtoul(level, NULL, 10);
+}
+
 #ifdef SYSLOG
 static inline int
 log_level_to_syslog(unsigned int level)
@@ -34,41 +72,227 @@ log_level_to_syslog(unsigned int level)
 }
 #endif
 
-void pr_helper(unsigned int level,
+static void output(unsigned int level,
 		void *object,
 		const char *file,
 		const char *function,
 		unsigned int line,
-		const char *fmt,
-		...)
+		const char *msg)
 {
-	char *tmp;
-	va_list args;
+	char tag[32] = "";
 
-	va_start(args, fmt);
+	if (log_handler) {
+		log_handler(level, object, file, function, line, msg, log_handler_data);
+		return;
+	}
 
-	if (vasprintf(&tmp, fmt, args) < 0)
-		goto leave;
+	/* tells the messages of each context apart */
+	if (object)
+		snprintf(tag, sizeof(tag), "[%p] ", object);
 
 	if (level <= 1) {
 #ifdef SYSLOG
-		syslog(log_level_to_syslog(level), "%s", tmp);
+		syslog(log_level_to_syslog(level), "%s%s", tag, msg);
 #endif
 		if (level == 0)
-			fprintf(stderr, "%s: %s\n", function, tmp);
+			fprintf(stderr, "%s%s: %s\n", tag, function, msg);
 		else
-			fprintf(stdout, "%s: %s\n", function, tmp);
+			fprintf(stdout, "%s%s: %s\n", tag, function, msg);
 	}
 	else if (level == 2)
-		fprintf(stdout, "%s:%s(%u): %s\n", file, function, line, tmp);
-#if defined(DEVEL) || defined(DEBUG)
+		fprintf(stdout, "%s%s:%s(%u): %s\n", tag, file, function, line, msg);
 	else if (level == 3)
-		fprintf(stdout, "%s: %s\n", function, tmp);
-#endif
-#ifdef DEBUG
-	else if (level == 4)
-		fprintf(stdout, "%s:%s(%u): %s\n", file, function, line, tmp);
-#endif
+		fprintf(stdout, "%s%s: %s\n", tag, function, msg);
+	else
+		fprintf(stdout, "%s%s:%s(%u): %s\n", tag, file, function, line, msg);
+}
+
+/*
+ * Asynchronous mode; callers format into a slot of a bounded ring, and a
+ * thread does the output. Any thread can push (the slot sequence numbers
+ * make it lock-free), only the log thread pops. When the ring is full the
+ * message is counted as dropped.
+ */
+
+struct log_record {
+	unsigned seq;
+	unsigned level;
+	void *object;
+	const char *file;
+	const char *function;
+	unsigned line;
+	char msg[LOG_MESSAGE_SIZE];
+};
+
+struct log_ring {
+	struct log_record records[LOG_RING];
+	unsigned tail; /* next to push */
+	unsigned head; /* next to pop */
+	unsigned drops;
+	unsigned reported; /* drops already reported */
+	bool quit;
+	sem_t sem;
+	pthread_t thread;
+};
+
+/* the ring is kept when disabled; a late caller may still push to it */
+static struct log_ring *ring;
+static struct log_ring *async;
+
+static struct log_record *ring_reserve(struct log_ring *r)
+{
+	struct log_record *rec;
+	unsigned pos, seq;
+
+	pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	while (true) {
+		rec = &r->records[pos % LOG_RING];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return rec;
+		} else if ((int) (seq - pos) < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void ring_drain(struct log_ring *r)
+{
+	struct log_record *rec;
+	unsigned drops;
+
+	while (true) {
+		rec = &r->records[r->head % LOG_RING];
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != r->head + 1)
+			break;
+		output(rec->level, rec->object, rec->file, rec->function, rec->line, rec->msg);
+		__atomic_store_n(&rec->seq, r->head + LOG_RING, __ATOMIC_RELEASE);
+		r->head++;
+	}
+
+	drops = __atomic_load_n(&r->drops, __ATOMIC_RELAXED);
+	if (drops != r->reported) {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "%u log messages dropped", drops - r->reported);
+		output(1, NULL, __FILE__, __func__, __LINE__, msg);
+		r->reported = drops;
+	}
+}
+
+static void *log_thread(void *data)
+{
+	struct log_ring *r = data;
+
+	while (true) {
+		sem_wait(&r->sem);
+		ring_drain(r);
+		if (__atomic_load_n(&r->quit, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	ring_drain(r);
+
+	return NULL;
+}
+
+static void stop_async(void)
+{
+	struct log_ring *r = async;
+
+	if (!r)
+		return;
+
+	__atomic_store_n(&async, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->quit, true, __ATOMIC_RELEASE);
+	sem_post(&r->sem);
+	pthread_join(r->thread, NULL);
+}
+
+bool td_set_log_async(bool enable)
+{
+	struct log_ring *r;
+	unsigned i;
+
+	if (!enable) {
+		stop_async();
+		return true;
+	}
+
+	if (async)
+		return true;
+
+	r = ring;
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r)
+			return false;
+		for (i = 0; i < LOG_RING; i++)
+			r->records[i].seq = i;
+		sem_init(&r->sem, 0, 0);
+		ring = r;
+	}
+
+	r->quit = false;
+	if (pthread_create(&r->thread, NULL, log_thread, r) != 0)
+		return false;
+
+	__atomic_store_n(&async, r, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+unsigned td_get_log_drops(void)
+{
+	struct log_ring *r = ring;
+
+	return r ? __atomic_load_n(&r->drops, __ATOMIC_RELAXED) : 0;
+}
+
+static void __attribute__((destructor)) log_exit(void)
+{
+	stop_async();
+}
+
+void pr_helper(unsigned int level,
+		void *object,
+		const char *file,
+		const char *function,
+		unsigned int line,
+		const char *fmt,
+		...)
+{
+	struct log_ring *r;
+	char *tmp;
+	va_list args;
+
+	va_start(args, fmt);
+
+	r = __atomic_load_n(&async, __ATOMIC_ACQUIRE);
+	if (r) {
+		struct log_record *rec = ring_reserve(r);
+		if (!rec) {
+			__atomic_add_fetch(&r->drops, 1, __ATOMIC_RELAXED);
+			goto leave;
+		}
+		rec->level = level;
+		rec->object = object;
+		rec->file = file;
+		rec->function = function;
+		rec->line = line;
+		vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+		__atomic_store_n(&rec->seq, rec->seq + 1, __ATOMIC_RELEASE);
+		sem_post(&r->sem);
+		goto leave;
+	}
+
+	if (vasprintf(&tmp, fmt, args) < 0)
+		goto leave;
+
+	output(level, object, file, function, line, tmp);
 
 	free(tmp);
 
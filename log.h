@@ -13,6 +13,9 @@
 
 /* #define DEBUG */
 
+/* messages above this level are discarded before formatting */
+extern unsigned int pr_level;
+
 void pr_helper(unsigned int level,
 		void *object,
 		const char *file,
@@ -21,9 +24,15 @@ void pr_helper(unsigned int level,
 		const char *fmt,
 		...) __attribute__((format(printf, 6, 7)));
 
-#define pr_base(level, object, ...) pr_helper(level, object, __FILE__, __func__, __LINE__, __VA_ARGS__)
+#define pr_call(level, object, ...) pr_helper(level, object, __FILE__, __func__, __LINE__, __VA_ARGS__)
+
+#define pr_base(level, object, ...) do { \
+	if ((level) <= pr_level) \
+		pr_call(level, object, __VA_ARGS__); \
+} while(0)
 
-#define pr_err(object, ...) pr_base(0, object, __VA_ARGS__)
+/* errors are always reported */
+#define pr_err(object, ...) pr_call(0, object, __VA_ARGS__)
 #define pr_warning(object, ...) pr_base(1, object, __VA_ARGS__)
 #define pr_test(object, ...) pr_base(2, object, __VA_ARGS__)
 
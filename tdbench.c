@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Runs a number of decoder contexts on the simulator from one reactor, and
+ * checks that each of them gets its share of the frames: none strays from
+ * the average by more than 10%.
+ */
+
+#include "tidsp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_STREAMS 30
+
+struct stream {
+	struct td_context *ctx;
+	unsigned frames;
+};
+
+static unsigned total;
+
+static void feed(struct td_context *ctx)
+{
+	struct td_port *p = ctx->ports[0];
+	unsigned i;
+
+	for (i = 0; i < p->nr_buffers; i++) {
+		struct td_buffer *tb = &p->buffers[i];
+		if (tb->used)
+			continue;
+		tb->data->len = 1000;
+		td_send_buffer(ctx, tb);
+	}
+}
+
+static void handle_buffer(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct stream *s = ctx->client;
+
+	if (tb->port->id == 0) {
+		feed(ctx);
+		return;
+	}
+
+	s->frames++;
+	total++;
+	td_send_buffer(ctx, tb);
+}
+
+static inline double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	struct stream streams[MAX_STREAMS] = { { 0 } };
+	struct td_reactor *r;
+	unsigned nr_streams, nr_frames, average, i;
+	double start;
+	int ret = 0;
+
+	if (argc > 4) {
+		fprintf(stderr, "usage: %s [contexts] [frames] [latency us]\n", argv[0]);
+		return 1;
+	}
+
+	nr_streams = argc > 1 ? atoi(argv[1]) : 8;
+	nr_frames = argc > 2 ? atoi(argv[2]) : 4000;
+	if (!nr_streams || nr_streams > MAX_STREAMS || nr_frames < nr_streams) {
+		fprintf(stderr, "1 to %u contexts, at least one frame each\n", MAX_STREAMS);
+		return 1;
+	}
+
+	td_use_simulator(argc > 3 ? atoi(argv[3]) : 100);
+
+	r = td_reactor_new();
+	if (!r)
+		return 1;
+
+	for (i = 0; i < nr_streams; i++) {
+		struct td_context *ctx;
+
+		ctx = streams[i].ctx = td_new(&streams[i]);
+		if (!ctx) {
+			ret = 1;
+			goto leave;
+		}
+		ctx->codec = &td_mp4vdec_codec;
+		ctx->width = 320;
+		ctx->height = 240;
+		ctx->handle_buffer = handle_buffer;
+
+		if (!td_init(ctx) || !td_reactor_add(r, ctx)) {
+			fprintf(stderr, "context %u failed to start\n", i);
+			ret = 1;
+			goto leave;
+		}
+		feed(ctx);
+	}
+
+	start = now_ms();
+	while (total < nr_frames) {
+		if (!td_reactor_run(r, 1000)) {
+			fprintf(stderr, "timed out after %u frames\n", total);
+			ret = 1;
+			goto leave;
+		}
+	}
+
+	printf("%u contexts, %u frames in %.1f ms:", nr_streams, total, now_ms() - start);
+	average = total / nr_streams;
+	for (i = 0; i < nr_streams; i++) {
+		unsigned frames = streams[i].frames;
+		printf(" %u", frames);
+		if (frames * 10 < average * 9 || frames * 10 > average * 11)
+			ret = 1;
+	}
+	printf("\n");
+
+	if (ret)
+		fprintf(stderr, "unfair: a context is more than 10%% off the average of %u\n",
+				average);
+
+leave:
+	for (i = 0; i < nr_streams; i++) {
+		struct td_context *ctx = streams[i].ctx;
+		if (!ctx)
+			continue;
+		td_reactor_remove(r, ctx);
+		td_close(ctx);
+		td_free(ctx);
+	}
+	td_reactor_free(r);
+
+	return ret;
+}
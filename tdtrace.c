@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Decodes a td_trace_dump() file; prints the records of all the threads
+ * merged by time.
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+struct entry {
+	struct trace_record rec;
+	uint32_t tid;
+};
+
+static const char *event_names[] = {
+	[TRACE_SEND] = "send",
+	[TRACE_RECV] = "recv",
+	[TRACE_MESSAGE] = "message",
+	[TRACE_MAP] = "map",
+	[TRACE_UNMAP] = "unmap",
+};
+
+static int cmp_time(const void *a, const void *b)
+{
+	const struct entry *ea = a, *eb = b;
+
+	if (ea->rec.time != eb->rec.time)
+		return ea->rec.time < eb->rec.time ? -1 : 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header header;
+	struct entry *entries = NULL;
+	size_t nr_entries = 0, i;
+	uint64_t start;
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+			header.magic != TRACE_MAGIC ||
+			header.version != TRACE_VERSION ||
+			header.record_size != sizeof(struct trace_record))
+	{
+		fprintf(stderr, "%s: not a trace file\n", argv[1]);
+		return 1;
+	}
+
+	for (i = 0; i < header.nr_rings; i++) {
+		struct trace_ring_header rh;
+		struct entry *tmp;
+		uint32_t j;
+
+		if (fread(&rh, sizeof(rh), 1, f) != 1)
+			break;
+
+		tmp = realloc(entries, (nr_entries + rh.nr_records) * sizeof(*entries));
+		if (!tmp)
+			return 1;
+		entries = tmp;
+
+		for (j = 0; j < rh.nr_records; j++) {
+			struct entry *e = &entries[nr_entries];
+			if (fread(&e->rec, sizeof(e->rec), 1, f) != 1)
+				break;
+			e->tid = rh.tid;
+			nr_entries++;
+		}
+	}
+
+	fclose(f);
+
+	qsort(entries, nr_entries, sizeof(*entries), cmp_time);
+
+	start = nr_entries ? entries[0].rec.time : 0;
+	for (i = 0; i < nr_entries; i++) {
+		struct trace_record *rec = &entries[i].rec;
+		const char *name = rec->event < TRACE_LAST ? event_names[rec->event] : "?";
+
+		printf("%12" PRIu64 " %6u %-8s %#" PRIx64 " port=%u arg=%#x\n",
+				rec->time - start, entries[i].tid, name,
+				rec->object, rec->port, rec->arg);
+	}
+
+	free(entries);
+
+	return 0;
+}
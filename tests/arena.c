@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Checks the arena allocator on the simulator: splitting and coalescing of
+ * the extents, fragmentation, and running out of DSP virtual space.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_arena.h"
+#include "dmm_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MB (1024UL * 1024)
+
+static int failed;
+
+#define check(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%i: %s\n", __FILE__, __LINE__, #cond); \
+			failed = 1; \
+		} \
+	} while (0)
+
+static struct td_arena_stats stats(struct dmm_arena *a)
+{
+	struct td_arena_stats s;
+
+	dmm_arena_get_stats(a, &s);
+	return s;
+}
+
+static void test_split_and_coalesce(int handle, void *proc)
+{
+	struct dmm_arena *a;
+	void *p[4];
+	unsigned i;
+
+	a = dmm_arena_new(handle, proc, 16 * PAGE_SIZE);
+	check(a);
+	if (!a)
+		return;
+
+	/* sizes are rounded up to pages; the slices are contiguous */
+	for (i = 0; i < 4; i++) {
+		p[i] = dmm_arena_alloc(a, PAGE_SIZE * i + 1);
+		check(p[i]);
+	}
+	check(p[1] == (char *) p[0] + PAGE_SIZE);
+	check(p[2] == (char *) p[1] + 2 * PAGE_SIZE);
+	check(p[3] == (char *) p[2] + 3 * PAGE_SIZE);
+	check(stats(a).allocations == 4);
+	check(stats(a).free == 6 * PAGE_SIZE);
+	check(stats(a).free_blocks == 1);
+
+	/* a hole, merged with neither neighbour */
+	check(dmm_arena_release(a, p[1]));
+	check(stats(a).free_blocks == 2);
+	check(stats(a).largest_free == 6 * PAGE_SIZE);
+
+	/* merged with the previous one */
+	check(dmm_arena_release(a, p[2]));
+	check(stats(a).free_blocks == 2);
+	check(stats(a).largest_free == 6 * PAGE_SIZE);
+	check(stats(a).free == 11 * PAGE_SIZE);
+
+	/* best fit takes the 5 page hole, not the tail */
+	p[1] = dmm_arena_alloc(a, 5 * PAGE_SIZE);
+	check(p[1] == (char *) p[0] + PAGE_SIZE);
+	check(stats(a).free_blocks == 1);
+	check(dmm_arena_release(a, p[1]));
+
+	/* merged with both */
+	check(dmm_arena_release(a, p[3]));
+	check(dmm_arena_release(a, p[0]));
+	check(stats(a).free_blocks == 1);
+	check(stats(a).largest_free == 16 * PAGE_SIZE);
+	check(stats(a).allocations == 0);
+	check(stats(a).fragmentation == 0);
+
+	/* not from this arena */
+	check(!dmm_arena_release(a, (char *) p[0] + 16 * PAGE_SIZE));
+
+	dmm_arena_free(a);
+}
+
+static void test_fragmentation(int handle, void *proc)
+{
+	struct dmm_arena *a;
+	void *p[8];
+	unsigned i;
+
+	a = dmm_arena_new(handle, proc, 8 * PAGE_SIZE);
+	check(a);
+	if (!a)
+		return;
+
+	for (i = 0; i < 8; i++)
+		p[i] = dmm_arena_alloc(a, PAGE_SIZE);
+	check(!dmm_arena_alloc(a, PAGE_SIZE));
+
+	/* every other page free: half the arena, but no two pages together */
+	for (i = 0; i < 8; i += 2)
+		check(dmm_arena_release(a, p[i]));
+	check(stats(a).free == 4 * PAGE_SIZE);
+	check(stats(a).free_blocks == 4);
+	check(stats(a).largest_free == PAGE_SIZE);
+	check(stats(a).fragmentation == 75);
+	check(!dmm_arena_alloc(a, 2 * PAGE_SIZE));
+	check(stats(a).failures == 2);
+
+	/* filling the holes back in coalesces everything */
+	for (i = 1; i < 8; i += 2)
+		check(dmm_arena_release(a, p[i]));
+	check(stats(a).free_blocks == 1);
+	check(stats(a).fragmentation == 0);
+	p[0] = dmm_arena_alloc(a, 8 * PAGE_SIZE);
+	check(p[0]);
+	check(dmm_arena_release(a, p[0]));
+
+	dmm_arena_free(a);
+}
+
+static void test_out_of_space(int handle, void *proc)
+{
+	struct dmm_arena *a[8];
+	unsigned i, count = 0;
+
+	/* the simulator has a bit over 3 GB of DSP virtual space */
+	for (i = 0; i < 8; i++) {
+		a[i] = dmm_arena_new(handle, proc, 1024 * MB);
+		if (a[i])
+			count++;
+	}
+	check(count == 3);
+
+	/* what's released can be reserved again */
+	for (i = 0; i < 8; i++) {
+		dmm_arena_free(a[i]);
+		a[i] = NULL;
+	}
+	a[0] = dmm_arena_new(handle, proc, 3 * 1024 * MB);
+	check(a[0]);
+	dmm_arena_free(a[0]);
+}
+
+int main(void)
+{
+	void *proc;
+	int handle;
+
+	td_use_simulator(0);
+
+	handle = dsp_open();
+	if (handle < 0 || !dsp_attach(handle, 0, NULL, &proc)) {
+		fprintf(stderr, "no simulator\n");
+		return 1;
+	}
+
+	test_split_and_coalesce(handle, proc);
+	test_fragmentation(handle, proc);
+	test_out_of_space(handle, proc);
+
+	dsp_detach(handle, proc);
+	dsp_close(handle);
+
+	if (!failed)
+		printf("arena: ok\n");
+	return failed;
+}
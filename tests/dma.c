@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+/*
+ * Checks the DSP_API 2 cache maintenance of dmm_buffer on the simulator:
+ * every range dmm_buffer_begin() opens is closed by exactly one
+ * dsp_end_dma() of the same range, whatever the tracking.
+ */
+
+#include "tidsp.h"
+#include "dsp_bridge.h"
+#include "dmm_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if DSP_API < 2
+#error "this test is for DSP_API 2"
+#endif
+
+#define MAX_OPEN 8
+
+static int failed;
+
+#define check(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%i: %s\n", __FILE__, __LINE__, #cond); \
+			failed = 1; \
+		} \
+	} while (0)
+
+static struct {
+	void *addr;
+	unsigned long size;
+} open_dma[MAX_OPEN];
+static unsigned nr_open, begins, ends, mismatches;
+
+static bool record_begin(int handle, void *proc_handle, void *mpu_addr,
+		unsigned long size, unsigned long dir)
+{
+	begins++;
+	if (nr_open >= MAX_OPEN)
+		return false;
+	open_dma[nr_open].addr = mpu_addr;
+	open_dma[nr_open].size = size;
+	nr_open++;
+	return true;
+}
+
+static bool record_end(int handle, void *proc_handle, void *mpu_addr,
+		unsigned long size, unsigned long dir)
+{
+	unsigned i;
+
+	ends++;
+	for (i = 0; i < nr_open; i++) {
+		if (open_dma[i].addr != mpu_addr || open_dma[i].size != size)
+			continue;
+		open_dma[i] = open_dma[--nr_open];
+		return true;
+	}
+
+	mismatches++;
+	return false;
+}
+
+static void reset(void)
+{
+	nr_open = begins = ends = mismatches = 0;
+}
+
+static dmm_buffer_t *buffer_new(int handle, void *proc, int dir, size_t size)
+{
+	dmm_buffer_t *b;
+
+	b = dmm_buffer_calloc(handle, proc, size, dir);
+	dmm_buffer_map(b);
+	return b;
+}
+
+static void test_untracked(int handle, void *proc)
+{
+	dmm_buffer_t *b = buffer_new(handle, proc, DMA_FROM_DEVICE, 0x1000);
+
+	/* the end length, what the DSP returned, doesn't matter */
+	reset();
+	dmm_buffer_begin(b, b->size);
+	dmm_buffer_end(b, 100);
+	check(begins == 1 && ends == 1 && !mismatches && !nr_open);
+
+	/* a range left open is closed before the next one */
+	reset();
+	dmm_buffer_begin(b, b->size);
+	dmm_buffer_begin(b, b->size);
+	dmm_buffer_end(b, b->size);
+	check(begins == 2 && ends == 2 && !mismatches && !nr_open);
+
+	dmm_buffer_free(b);
+}
+
+static void test_dirty(int handle, void *proc)
+{
+	dmm_buffer_t *b = buffer_new(handle, proc, DMA_TO_DEVICE, 0x1000);
+
+	dmm_buffer_track_dirty(b);
+
+	/* only the dirty range, and closed the same */
+	reset();
+	dmm_buffer_dirty(b, 8, 8);
+	dmm_buffer_begin(b, b->size);
+	check(nr_open == 1 && open_dma[0].addr == (char *) b->data + 8 &&
+			open_dma[0].size == 8);
+	dmm_buffer_end(b, b->size);
+	check(begins == 1 && ends == 1 && !mismatches && !nr_open);
+
+	/* nothing dirty; nothing to begin or end */
+	reset();
+	dmm_buffer_begin(b, b->size);
+	dmm_buffer_end(b, b->size);
+	check(begins == 0 && ends == 0);
+
+	dmm_buffer_free(b);
+}
+
+static void test_params(int handle, void *proc)
+{
+	dmm_buffer_t *b = buffer_new(handle, proc, DMA_BIDIRECTIONAL, 0x1000);
+
+	dmm_buffer_track_dirty(b);
+	dmm_buffer_track(b, 0, 16);
+
+	/* nothing dirty, but the DSP writes; the whole length is begun */
+	reset();
+	dmm_buffer_begin(b, b->size);
+	check(nr_open == 1 && open_dma[0].addr == b->data &&
+			open_dma[0].size == b->size);
+	dmm_buffer_end(b, b->size);
+	check(begins == 1 && ends == 1 && !mismatches && !nr_open);
+
+	/* reading past the read range doesn't end it twice */
+	dmm_buffer_end_range(b, 16, 64);
+	check(ends == 1);
+
+	/* nor before the end */
+	reset();
+	dmm_buffer_dirty(b, 0, 4);
+	dmm_buffer_begin(b, b->size);
+	dmm_buffer_end_range(b, 16, 64);
+	dmm_buffer_end(b, b->size);
+	check(begins == 1 && ends == 1 && !mismatches && !nr_open);
+
+	dmm_buffer_free(b);
+}
+
+int main(void)
+{
+	struct dsp_backend backend = dsp_sim_backend;
+	void *proc;
+	int handle;
+
+	backend.begin_dma = record_begin;
+	backend.end_dma = record_end;
+	dsp_set_backend(&backend);
+
+	handle = dsp_open();
+	if (handle < 0 || !dsp_attach(handle, 0, NULL, &proc)) {
+		fprintf(stderr, "no simulator\n");
+		return 1;
+	}
+
+	test_untracked(handle, proc);
+	test_dirty(handle, proc);
+	test_params(handle, proc);
+
+	dsp_detach(handle, proc);
+	dsp_close(handle);
+
+	if (!failed)
+		printf("dma: ok\n");
+	return failed;
+}
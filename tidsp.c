@@ -12,41 +12,20 @@
 #include "dmm_buffer.h"
 #include "log.h"
 #include "util.h"
+#include "usn.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define TD_MAX_DEPTH 8
+#define TD_CACHE_ALIGN 128
 
 struct td_context;
 struct td_port;
 struct td_buffer;
 
-/* mpu <-> dsp communication structure */
-struct usn_comm {
-	uintptr_t buffer_data;
-	uint32_t buffer_size;
-	uintptr_t param_data;
-	uint32_t param_size;
-	uint32_t buffer_len;
-	uint32_t silly_eos;
-	uint32_t silly_buf_state;
-	uint32_t silly_buf_active;
-	uint32_t silly_buf_id;
-#if SN_API >= 2
-	uint32_t nb_available_buf;
-	uint32_t donot_flush_buf;
-	uint32_t donot_invalidate_buf;
-#endif
-	uint32_t reserved;
-	uintptr_t msg_virt;
-	uintptr_t buffer_virt;
-	uintptr_t param_virt;
-	uint32_t silly_out_buffer_index;
-	uint32_t silly_in_buffer_index;
-	uintptr_t user_data;
-	uint32_t stream_id;
-};
-
-typedef struct usn_comm usn_comm_t;
-
 struct td_port *td_port_new(int id, int dir)
 {
 	struct td_port *p;
@@ -71,13 +50,188 @@ void td_port_free(struct td_port *p)
 
 void td_port_alloc_buffers(struct td_port *p, unsigned nr_buffers)
 {
-	p->nr_buffers = nr_buffers;
+	p->nr_buffers = p->max_buffers = nr_buffers;
 	free(p->buffers);
 	p->buffers = calloc(nr_buffers, sizeof(*p->buffers));
 	for (unsigned i = 0; i < p->nr_buffers; i++)
 		p->buffers[i].port = p;
 }
 
+void td_port_set_depth(struct td_port *p, unsigned nr_buffers)
+{
+	p->depth = nr_buffers;
+}
+
+void td_set_auto_depth(struct td_context *ctx, size_t mem_limit)
+{
+	ctx->auto_depth_limit = mem_limit;
+}
+
+void td_set_node_priority(struct td_context *ctx, unsigned priority, unsigned timeout)
+{
+	ctx->priority = priority;
+	ctx->timeout = timeout;
+}
+
+void td_set_profile(struct td_context *ctx, unsigned profile_id)
+{
+	ctx->profile = profile_id;
+}
+
+void td_set_performance_mode(struct td_context *ctx, int mode)
+{
+	ctx->performance_mode = mode;
+}
+
+bool td_port_set_lazy_invalidate(struct td_port *p, bool enable)
+{
+	/* the DSP only writes to output buffers */
+	if (p->dir != DMA_FROM_DEVICE)
+		return false;
+	p->lazy_invalidate = enable;
+	return true;
+}
+
+void td_buffer_cpu_access(struct td_buffer *tb)
+{
+	dmm_buffer_t *b = tb->data;
+
+	if (!tb->stale)
+		return;
+
+	dmm_buffer_end(b, b->len);
+	tb->stale = false;
+}
+
+/*
+ * Process wide pool of frame buffers, keyed by direction and size class;
+ * classes are eight per power of two, so a buffer is at most 1/8 too big.
+ */
+struct td_pool_buffer {
+	struct td_pool_buffer *next;
+	dmm_buffer_t *b;
+};
+
+static struct {
+	struct td_pool_buffer *buffers;
+	size_t size, limit;
+	unsigned count, hits, misses;
+} buffer_pool;
+static pthread_mutex_t buffer_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t buffer_pool_class(size_t size)
+{
+	size_t step = PAGE_SIZE;
+
+	while (step * 16 <= size)
+		step *= 2;
+	return ROUND_UP(size, step);
+}
+
+static dmm_buffer_t *buffer_pool_get(int dir, size_t size, bool huge)
+{
+	struct td_pool_buffer **pb, *e;
+	dmm_buffer_t *b = NULL;
+
+	size = buffer_pool_class(size);
+
+	pthread_mutex_lock(&buffer_pool_lock);
+	for (pb = &buffer_pool.buffers; *pb; pb = &(*pb)->next) {
+		e = *pb;
+		if (e->b->dir != dir || e->b->pool_size != size || e->b->huge != huge)
+			continue;
+		*pb = e->next;
+		b = e->b;
+		free(e);
+		buffer_pool.size -= size;
+		buffer_pool.count--;
+		break;
+	}
+	if (b)
+		buffer_pool.hits++;
+	else
+		buffer_pool.misses++;
+	pthread_mutex_unlock(&buffer_pool_lock);
+
+	return b;
+}
+
+/* frees the buffer, or keeps it in the pool if it fits */
+static void buffer_pool_put(dmm_buffer_t *b)
+{
+	struct td_pool_buffer *e;
+
+	/* only the pool's own allocations go back */
+	if (!b->pool_size || !b->allocated_data || b->data != b->allocated_data)
+		goto free;
+
+	/* the mapping belongs to the context's arena */
+	dmm_buffer_unmap(b);
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		goto free;
+
+	pthread_mutex_lock(&buffer_pool_lock);
+	if (buffer_pool.size + b->pool_size > buffer_pool.limit) {
+		pthread_mutex_unlock(&buffer_pool_lock);
+		free(e);
+		goto free;
+	}
+	e->b = b;
+	e->next = buffer_pool.buffers;
+	buffer_pool.buffers = e;
+	buffer_pool.size += b->pool_size;
+	buffer_pool.count++;
+	pthread_mutex_unlock(&buffer_pool_lock);
+	return;
+
+free:
+	dmm_buffer_free(b);
+}
+
+void td_buffer_pool_trim(size_t size)
+{
+	struct td_pool_buffer *e, *list = NULL;
+
+	pthread_mutex_lock(&buffer_pool_lock);
+	while (buffer_pool.size > size) {
+		e = buffer_pool.buffers;
+		buffer_pool.buffers = e->next;
+		buffer_pool.size -= e->b->pool_size;
+		buffer_pool.count--;
+		e->next = list;
+		list = e;
+	}
+	pthread_mutex_unlock(&buffer_pool_lock);
+
+	while (list) {
+		e = list;
+		list = e->next;
+		dmm_buffer_free(e->b);
+		free(e);
+	}
+}
+
+void td_buffer_pool_set_limit(size_t limit)
+{
+	pthread_mutex_lock(&buffer_pool_lock);
+	buffer_pool.limit = limit;
+	pthread_mutex_unlock(&buffer_pool_lock);
+	td_buffer_pool_trim(limit);
+}
+
+void td_buffer_pool_get_stats(struct td_buffer_pool_stats *stats)
+{
+	pthread_mutex_lock(&buffer_pool_lock);
+	stats->size = buffer_pool.size;
+	stats->limit = buffer_pool.limit;
+	stats->buffers = buffer_pool.count;
+	stats->hits = buffer_pool.hits;
+	stats->misses = buffer_pool.misses;
+	pthread_mutex_unlock(&buffer_pool_lock);
+}
+
 void td_port_flush(struct td_port *p)
 {
 	unsigned i;
@@ -87,26 +241,103 @@ void td_port_flush(struct td_port *p)
 		dmm_buffer_t *b = tb->data;
 		if (!b)
 			continue;
-		dmm_buffer_free(b);
+		buffer_pool_put(b);
 		tb->data = NULL;
 	}
 }
 
+/* a zeroed and page aligned buffer to be sliced */
+static dmm_buffer_t *slab_new(struct td_context *ctx, size_t size, int dir)
+{
+	dmm_buffer_t *slab;
+
+	size = ROUND_UP(size, PAGE_SIZE);
+
+	slab = dmm_buffer_new(ctx->dsp_handle, ctx->proc, dir);
+	if (posix_memalign(&slab->allocated_data, PAGE_SIZE, size) != 0) {
+		free(slab);
+		return NULL;
+	}
+	dmm_buffer_use(slab, slab->allocated_data, size);
+	memset(slab->data, 0, size);
+
+	return slab;
+}
+
+/* the DSP virtual space a mapping of size takes, as dmm_buffer_map() reserves it */
+static inline size_t map_size(size_t size)
+{
+	return ROUND_UP(size, PAGE_SIZE) + PAGE_SIZE;
+}
+
+/* maps the params slab of the port, points the slices into it, and flushes it */
+static void map_params(struct td_context *ctx, struct td_port *p)
+{
+	dmm_buffer_t *slab = p->params_slab;
+	unsigned i;
+
+	if (!slab || slab->map)
+		return;
+
+	slab->arena = ctx->arena;
+	dmm_buffer_map(slab);
+
+	for (i = 0; i < p->max_buffers; i++) {
+		dmm_buffer_t *b = p->buffers[i].params;
+		if (b)
+			b->map = (char *) slab->map + ((char *) b->data - (char *) slab->data);
+	}
+
+	dmm_buffer_begin(slab, slab->size);
+}
+
+/*
+ * The params of all the buffers of a port share one slab. While the node
+ * is being created the slab is mapped later, once the arena is sized for it.
+ */
 void td_port_setup_params(struct td_context *ctx,
 		struct td_port *p,
 		size_t size,
 		td_setup_params_func func)
 {
+	size_t slot = ROUND_UP(size, TD_CACHE_ALIGN);
+	dmm_buffer_t *slab;
 	unsigned i;
+
+	slab = slab_new(ctx, p->nr_buffers * slot, DMA_BIDIRECTIONAL);
+	if (!slab) {
+		pr_err(ctx->client, "failed to allocate params");
+		return;
+	}
+	p->params_slab = slab;
+
 	for (i = 0; i < p->nr_buffers; i++) {
 		dmm_buffer_t *b;
-		b = dmm_buffer_calloc(ctx->dsp_handle,
-				ctx->proc, size, DMA_BIDIRECTIONAL);
+		b = dmm_buffer_slice(slab, i * slot, size);
 		if (func)
 			func(ctx, b);
-		dmm_buffer_map(b);
+		/* flushed with the slab, all at once */
+		if (p->dirty_params)
+			dmm_buffer_track_dirty(b);
 		p->buffers[i].params = b;
 	}
+
+	if (ctx->node)
+		map_params(ctx, p);
+}
+
+static void free_params(struct td_port *p)
+{
+	unsigned i;
+
+	for (i = 0; i < p->nr_buffers; i++) {
+		dmm_buffer_free(p->buffers[i].params);
+		p->buffers[i].params = NULL;
+	}
+
+	dmm_buffer_free(p->params_slab);
+	p->params_slab = NULL;
+	p->dirty_params = false;
 }
 
 struct td_context *td_new(void *client)
@@ -135,9 +366,164 @@ void td_free(struct td_context *ctx)
 	td_port_free(ctx->ports[1]);
 	td_port_free(ctx->ports[0]);
 
+	free(ctx->priv);
 	free(ctx);
 }
 
+/*
+ * Mapping cache; keeps non-pinned buffers mapped on the DSP after they are
+ * returned, so a recycled buffer (same data, size and direction) doesn't
+ * need to be reserved and mapped again on every frame.
+ */
+
+struct td_map_entry {
+	void *data;
+	size_t size;
+	int dir;
+	struct dmm_arena *arena;
+	void *reserve;
+	void *map;
+	unsigned long last_used;
+	bool busy;
+};
+
+struct td_map_cache {
+	unsigned nr_entries;
+	unsigned long clock;
+	struct td_map_entry entries[];
+};
+
+static struct td_map_cache *map_cache_new(unsigned nr_entries)
+{
+	struct td_map_cache *c;
+
+	c = calloc(1, sizeof(*c) + nr_entries * sizeof(*c->entries));
+	if (!c)
+		return NULL;
+	c->nr_entries = nr_entries;
+
+	return c;
+}
+
+static inline void map_entry_release(struct td_context *ctx, struct td_map_entry *e)
+{
+	if (e->map)
+		dsp_unmap(ctx->dsp_handle, ctx->proc, e->map);
+	if (e->reserve)
+		dmm_unreserve(ctx->dsp_handle, ctx->proc, e->arena, e->reserve);
+	memset(e, 0, sizeof(*e));
+}
+
+static void map_cache_free(struct td_context *ctx)
+{
+	struct td_map_cache *c = ctx->map_cache;
+	unsigned i;
+
+	if (!c)
+		return;
+
+	for (i = 0; i < c->nr_entries; i++)
+		map_entry_release(ctx, &c->entries[i]);
+
+	free(c);
+	ctx->map_cache = NULL;
+}
+
+static bool map_cache_get(struct td_context *ctx, struct td_buffer *tb)
+{
+	struct td_map_cache *c = ctx->map_cache;
+	dmm_buffer_t *b = tb->data;
+	struct td_map_entry *e, *victim = NULL;
+	unsigned i;
+
+	if (!c)
+		return false;
+
+	c->clock++;
+
+	for (i = 0; i < c->nr_entries; i++) {
+		e = &c->entries[i];
+		if (e->data == b->data && e->size == b->size && e->dir == b->dir && e->map) {
+			if (e->busy)
+				return false;
+			goto found;
+		}
+	}
+
+	/* pick an empty slot, a stale mapping of the same data, or the LRU */
+	for (i = 0; i < c->nr_entries; i++) {
+		e = &c->entries[i];
+		if (e->busy)
+			continue;
+		if (!e->map || e->data == b->data) {
+			victim = e;
+			break;
+		}
+		if (!victim || e->last_used < victim->last_used)
+			victim = e;
+	}
+
+	if (!victim)
+		return false;
+
+	e = victim;
+	map_entry_release(ctx, e);
+
+	dmm_buffer_map(b);
+	if (!b->map) {
+		dmm_buffer_unmap(b);
+		return false;
+	}
+
+	/* the cache owns the mapping from now on */
+	e->data = b->data;
+	e->size = b->size;
+	e->dir = b->dir;
+	e->arena = b->arena;
+	e->reserve = b->reserve;
+	e->map = b->map;
+
+	e->busy = true;
+	e->last_used = c->clock;
+	tb->map_entry = e;
+	return true;
+
+found:
+	b->reserve = e->reserve;
+	b->map = e->map;
+	dmm_buffer_begin(b, b->len);
+
+	e->busy = true;
+	e->last_used = c->clock;
+	tb->map_entry = e;
+	return true;
+}
+
+static inline void map_cache_put(struct td_buffer *tb, dmm_buffer_t *b)
+{
+	struct td_map_entry *e = tb->map_entry;
+
+	e->busy = false;
+	b->reserve = NULL;
+	b->map = NULL;
+	tb->map_entry = NULL;
+}
+
+void td_map_cache_forget(struct td_context *ctx, void *data)
+{
+	struct td_map_cache *c = ctx->map_cache;
+	unsigned i;
+
+	if (!c)
+		return;
+
+	for (i = 0; i < c->nr_entries; i++) {
+		struct td_map_entry *e = &c->entries[i];
+		if (e->data == data && !e->busy)
+			map_entry_release(ctx, e);
+	}
+}
+
 bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb)
 {
 	usn_comm_t *msg_data;
@@ -148,6 +534,12 @@ bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb)
 	pr_debug(ctx->client, "sending %s buffer", index == 0 ? "input" : "output");
 
 	tb->used = true;
+	tb->stale = false;
+	if (++port->queued > port->max_queued)
+		port->max_queued = port->queued;
+	tb->send_time = now_us();
+	if (tb->recv_time)
+		ewma(&port->hold_time, tb->send_time - tb->recv_time);
 
 	msg_data = tb->comm->data;
 
@@ -162,7 +554,7 @@ bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb)
 			dmm_buffer_begin(buffer, buffer->len);
 		else
 			tb->clean = false;
-	} else {
+	} else if (!map_cache_get(ctx, tb)) {
 		dmm_buffer_map(buffer);
 	}
 
@@ -175,6 +567,11 @@ bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb)
 
 	msg_data->user_data = (uintptr_t) buffer;
 
+#if SN_API >= 2
+	if (tb->pinned && port->lazy_invalidate && port->dir == DMA_FROM_DEVICE)
+		msg_data->donot_invalidate_buf = 1;
+#endif
+
 	if (tb->params) {
 		msg_data->param_data = (uintptr_t) tb->params->map;
 		msg_data->param_size = tb->params->len;
@@ -183,140 +580,624 @@ bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb)
 
 	dmm_buffer_begin(tb->comm, sizeof(*msg_data));
 
+	trace(TRACE_SEND, ctx, port->id, msg_data->buffer_len);
+
 	dsp_send_message(ctx->dsp_handle, ctx->node,
 			0x0600 | port->id, (uintptr_t) tb->comm->map, 0);
 
 	return true;
 }
 
-static void *vdec_create_node(struct td_context *ctx)
+unsigned td_send_batch(struct td_context *ctx, struct td_port *p, unsigned count,
+		td_fill_func fill, void *data)
 {
-	struct td_codec *codec;
-	int dsp_handle;
-	struct dsp_node *node;
+	unsigned i, sent = 0;
 
-	const struct dsp_uuid usn_uuid = { 0x79A3C8B3, 0x95F2, 0x403F, 0x9A, 0x4B,
-		{ 0xCF, 0x80, 0x57, 0x73, 0x05, 0x41 } };
+	for (i = 0; i < p->nr_buffers && sent < count; i++) {
+		struct td_buffer *tb = &p->buffers[i];
+		if (tb->used)
+			continue;
+		if (!fill(ctx, tb, sent, data))
+			break;
+		td_send_buffer(ctx, tb);
+		sent++;
+	}
 
-	const struct dsp_uuid ringio_uuid = { 0x47698bfb, 0xa7ee, 0x417e, 0xa6, 0x7a,
-		{ 0x41, 0xc0, 0x27, 0x9e, 0xb8, 0x05 } };
+	return sent;
+}
 
-	const struct dsp_uuid conversions_uuid = { 0x722DD0DA, 0xF532, 0x4238, 0xB8, 0x46,
-		{ 0xAB, 0xFF, 0x5D, 0xA4, 0xBA, 0x02 } };
+/*
+ * Session; the bridge handle, the processor attachment and the registered
+ * libraries are shared by all the contexts of the process.
+ */
 
-	dsp_handle = ctx->dsp_handle;
+struct td_session_object {
+	struct dsp_uuid uuid;
+	enum dsp_dcd_object_type type;
+};
 
-	if (!dsp_register(dsp_handle, &ringio_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "ringio.dll64P")) {
-		pr_err(ctx->client, "failed to register ringio node library");
-		return NULL;
-	}
+struct td_session {
+	int handle;
+	void *proc;
+	unsigned refcount;
+	bool broken;
+	struct td_session_object *objects;
+	unsigned nr_objects;
+	struct td_watch *watch;
+};
 
-	if (!dsp_register(dsp_handle, &usn_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "usn.dll64P")) {
-		pr_err(ctx->client, "failed to register usn node library");
-		return NULL;
-	}
+static struct td_session *session;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	codec = ctx->codec;
-	if (!codec) {
-		pr_err(ctx->client, "unknown algorithm");
-		return NULL;
-	}
+static void watch_free(struct td_watch *w);
 
-	pr_info(ctx->client, "algo=%s", codec->filename);
+static struct td_session *session_get(struct td_context *ctx)
+{
+	struct td_session *s;
 
-	/* SN_API == 0 doesn't have it, so don't fail */
-	(void) dsp_register(dsp_handle, &conversions_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "conversions.dll64P");
+	pthread_mutex_lock(&session_lock);
 
-	if (!dsp_register(dsp_handle, codec->uuid, DSP_DCD_LIBRARYTYPE, codec->filename)) {
-		pr_err(ctx->client, "failed to register algo node library");
-		return NULL;
+	s = session;
+	if (s) {
+		s->refcount++;
+		goto leave;
 	}
 
-	if (!dsp_register(dsp_handle, codec->uuid, DSP_DCD_NODETYPE, codec->filename)) {
-		pr_err(ctx->client, "failed to register algo node");
-		return NULL;
-	}
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		goto leave;
 
-	{
-		struct dsp_node_attr_in attrs = {
-			.cb = sizeof(attrs),
-			.priority = 5,
-			.timeout = 1000,
-		};
-		void *arg_data;
-
-		codec->create_args(ctx, &attrs.profile_id, &arg_data);
-
-		if (!arg_data)
-			return NULL;
-
-		if (!dsp_node_allocate(dsp_handle, ctx->proc, codec->uuid, arg_data, &attrs, &node)) {
-			pr_err(ctx->client, "dsp node allocate failed");
-			free(arg_data);
-			return NULL;
-		}
-		free(arg_data);
+	s->handle = dsp_open();
+	if (s->handle < 0) {
+		pr_err(ctx->client, "dsp open failed");
+		goto fail;
 	}
 
-	if (!dsp_node_create(dsp_handle, node)) {
-		pr_err(ctx->client, "dsp node create failed");
-		dsp_node_free(dsp_handle, node);
-		return NULL;
+	if (!dsp_attach(s->handle, 0, NULL, &s->proc)) {
+		pr_err(ctx->client, "dsp attach failed");
+		if (dsp_close(s->handle) < 0)
+			pr_err(ctx->client, "dsp close failed");
+		goto fail;
 	}
 
-	pr_info(ctx->client, "dsp node created");
+	s->refcount = 1;
+	session = s;
 
-	if (codec->setup_params)
-		codec->setup_params(ctx);
+leave:
+	pthread_mutex_unlock(&session_lock);
+	return s;
 
-	if (codec->send_params)
-		codec->send_params(ctx, node);
+fail:
+	free(s);
+	pthread_mutex_unlock(&session_lock);
+	return NULL;
+}
 
-	return node;
+static void session_ref(struct td_session *s)
+{
+	pthread_mutex_lock(&session_lock);
+	s->refcount++;
+	pthread_mutex_unlock(&session_lock);
 }
 
-static inline void setup_buffers(struct td_context *ctx)
+static bool session_put(struct td_session *s, void *client, bool error)
 {
-	dmm_buffer_t *b;
-	struct td_port *p;
-	unsigned i;
+	bool ret = true;
 
-	p = ctx->ports[0];
-	for (i = 0; i < p->nr_buffers; i++) {
-		p->buffers[i].data = b = dmm_buffer_new(ctx->dsp_handle, ctx->proc, p->dir);
-		dmm_buffer_allocate(b, ctx->output_buffer_size);
-	}
+	pthread_mutex_lock(&session_lock);
 
-	p = ctx->ports[1];
-	for (i = 0; i < p->nr_buffers; i++) {
-		struct td_buffer *tb = &p->buffers[i];
-		tb->data = b = dmm_buffer_new(ctx->dsp_handle, ctx->proc, p->dir);
-		dmm_buffer_allocate(b, ctx->output_buffer_size);
-		td_send_buffer(ctx, tb);
+	/* after a DSP error new contexts get a new session */
+	if (error) {
+		s->broken = true;
+		if (session == s)
+			session = NULL;
 	}
-}
 
-static bool send_play_message(struct td_context *ctx)
-{
-	return dsp_send_message(ctx->dsp_handle, ctx->node, 0x0100, 0, 0);
-};
+	if (--s->refcount)
+		goto leave;
 
-static bool _dsp_start(struct td_context *ctx)
+	if (session == s)
+		session = NULL;
+
+	/* no context is watched anymore */
+	watch_free(s->watch);
+
+	if (!s->broken && !dsp_detach(s->handle, s->proc)) {
+		pr_err(client, "dsp detach failed");
+		ret = false;
+	}
+
+	if (dsp_close(s->handle) < 0) {
+		pr_err(client, "dsp close failed");
+		ret = false;
+	}
+
+	free(s->objects);
+	free(s);
+
+leave:
+	pthread_mutex_unlock(&session_lock);
+	return ret;
+}
+
+/* registers a DCD object only once per session */
+static bool session_register(struct td_session *s,
+		const struct dsp_uuid *uuid,
+		enum dsp_dcd_object_type type,
+		const char *path)
 {
+	struct td_session_object *tmp;
 	bool ret = true;
 	unsigned i;
 
+	pthread_mutex_lock(&session_lock);
+
+	for (i = 0; i < s->nr_objects; i++) {
+		struct td_session_object *o = &s->objects[i];
+		if (o->type == type && !memcmp(&o->uuid, uuid, sizeof(*uuid)))
+			goto leave;
+	}
+
+	if (!dsp_register(s->handle, uuid, type, path)) {
+		ret = false;
+		goto leave;
+	}
+
+	tmp = realloc(s->objects, (s->nr_objects + 1) * sizeof(*s->objects));
+	if (!tmp)
+		goto leave;
+	s->objects = tmp;
+	s->objects[s->nr_objects].uuid = *uuid;
+	s->objects[s->nr_objects].type = type;
+	s->nr_objects++;
+
+leave:
+	pthread_mutex_unlock(&session_lock);
+	return ret;
+}
+
+static bool register_codec(struct td_context *ctx)
+{
+	struct td_codec *codec = ctx->codec;
+	struct td_session *s = ctx->session;
+
+	const struct dsp_uuid usn_uuid = { 0x79A3C8B3, 0x95F2, 0x403F, 0x9A, 0x4B,
+		{ 0xCF, 0x80, 0x57, 0x73, 0x05, 0x41 } };
+
+	const struct dsp_uuid ringio_uuid = { 0x47698bfb, 0xa7ee, 0x417e, 0xa6, 0x7a,
+		{ 0x41, 0xc0, 0x27, 0x9e, 0xb8, 0x05 } };
+
+	const struct dsp_uuid conversions_uuid = { 0x722DD0DA, 0xF532, 0x4238, 0xB8, 0x46,
+		{ 0xAB, 0xFF, 0x5D, 0xA4, 0xBA, 0x02 } };
+
+	if (!session_register(s, &ringio_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "ringio.dll64P")) {
+		pr_err(ctx->client, "failed to register ringio node library");
+		return false;
+	}
+
+	if (!session_register(s, &usn_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "usn.dll64P")) {
+		pr_err(ctx->client, "failed to register usn node library");
+		return false;
+	}
+
+	pr_info(ctx->client, "algo=%s", codec->filename);
+
+	/* SN_API == 0 doesn't have it, so don't fail */
+	(void) session_register(s, &conversions_uuid, DSP_DCD_LIBRARYTYPE, DSP_DIR "conversions.dll64P");
+
+	if (!session_register(s, codec->uuid, DSP_DCD_LIBRARYTYPE, codec->filename)) {
+		pr_err(ctx->client, "failed to register algo node library");
+		return false;
+	}
+
+	if (!session_register(s, codec->uuid, DSP_DCD_NODETYPE, codec->filename)) {
+		pr_err(ctx->client, "failed to register algo node");
+		return false;
+	}
+
+	return true;
+}
+
+static struct dsp_node *allocate_node(struct td_context *ctx, void *arg_data)
+{
+	struct td_codec *codec = ctx->codec;
+	int dsp_handle = ctx->dsp_handle;
+	struct dsp_node *node;
+
+	struct dsp_node_attr_in attrs = {
+		.cb = sizeof(attrs),
+		.priority = ctx->priority ? ctx->priority : 5,
+		.timeout = ctx->timeout ? ctx->timeout : 1000,
+		.profile_id = ctx->profile ? ctx->profile : ctx->profile_id,
+	};
+
+	if (!register_codec(ctx))
+		return NULL;
+
+	if (!dsp_node_allocate(dsp_handle, ctx->proc, codec->uuid, arg_data, &attrs, &node)) {
+		pr_err(ctx->client, "dsp node allocate failed");
+		return NULL;
+	}
+
+	if (!dsp_node_create(dsp_handle, node)) {
+		pr_err(ctx->client, "dsp node create failed");
+		dsp_node_free(dsp_handle, node);
+		return NULL;
+	}
+
+	pr_info(ctx->client, "dsp node created");
+
+	return node;
+}
+
+/*
+ * Node pool; nodes created and run ahead of time for a codec and profile
+ * tier. td_init() takes a matching one instead of creating its own, and
+ * td_close() stops it and gives it back instead of terminating it.
+ */
+
+struct td_pool_node {
+	struct td_pool_node *next;
+	struct td_session *session;
+	struct td_codec *codec;
+	unsigned profile_id;
+	void *args; /* the node was created with */
+	struct dsp_node *node;
+	struct dsp_notification *event;
+	bool busy;
+};
+
+static struct td_pool_node *pool;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the create args of every codec start with their size, less that field */
+static inline size_t args_size(const void *arg_data)
+{
+	return *(const uint32_t *) arg_data + sizeof(uint32_t);
+}
+
+static void pool_node_free(struct td_pool_node *n, void *client)
+{
+	int dsp_handle = n->session->handle;
+	unsigned long exit_status;
+
+	if (!dsp_node_terminate(dsp_handle, n->node, &exit_status))
+		pr_err(client, "dsp node terminate failed: 0x%lx", exit_status);
+
+	if (!dsp_node_free(dsp_handle, n->node))
+		pr_err(client, "dsp node free failed");
+
+	free(n->event);
+	free(n->args);
+	session_put(n->session, client, false);
+	free(n);
+}
+
+static struct td_pool_node *pool_node_new(struct td_context *ctx)
+{
+	struct td_pool_node *n;
+	void *arg_data;
+
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		return NULL;
+
+	ctx->codec->create_args(ctx, &ctx->profile_id, &arg_data);
+	if (!arg_data)
+		goto fail;
+
+	n->node = allocate_node(ctx, arg_data);
+	if (!n->node) {
+		free(arg_data);
+		goto fail;
+	}
+
+	n->session = ctx->session;
+	session_ref(n->session);
+	n->codec = ctx->codec;
+	n->profile_id = ctx->profile_id;
+	n->args = arg_data;
+
+	if (!dsp_node_run(ctx->dsp_handle, n->node)) {
+		pr_err(ctx->client, "dsp node run failed");
+		pool_node_free(n, ctx->client);
+		return NULL;
+	}
+
+	n->event = calloc(1, sizeof(struct dsp_notification));
+	if (!dsp_node_register_notify(ctx->dsp_handle, n->node,
+				DSP_NODEMESSAGEREADY, 1,
+				n->event))
+	{
+		pr_err(ctx->client, "failed to register for notifications");
+		pool_node_free(n, ctx->client);
+		return NULL;
+	}
+
+	return n;
+
+fail:
+	free(n);
+	return NULL;
+}
+
+/* a node created with exactly the same args */
+static struct td_pool_node *pool_take(struct td_context *ctx, void *arg_data)
+{
+	struct td_pool_node *n;
+
+	/* pooled nodes have the default attributes */
+	if (ctx->priority || ctx->timeout || ctx->profile)
+		return NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	for (n = pool; n; n = n->next) {
+		if (n->busy || n->session != ctx->session)
+			continue;
+		if (n->codec == ctx->codec &&
+				n->profile_id == ctx->profile_id &&
+				args_size(n->args) == args_size(arg_data) &&
+				memcmp(n->args, arg_data, args_size(arg_data)) == 0)
+		{
+			n->busy = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	return n;
+}
+
+static inline void got_message(struct td_context *ctx, struct dsp_msg *msg);
+
+/*
+ * Waits for the node to acknowledge the stop, dropping the buffers it
+ * returns, which the caller takes back afterwards; events and alg ctrl
+ * replies are handled as usual.
+ */
+static bool wait_for_stop(struct td_context *ctx)
+{
+	struct dsp_msg msg;
+
+	while (dsp_node_get_message(ctx->dsp_handle, ctx->node, &msg, 1000)) {
+		uint32_t command_id = msg.cmd & 0xffffff00;
+
+		if (command_id == 0x0200)
+			return true;
+		if (command_id != 0x0600)
+			got_message(ctx, &msg);
+	}
+
+	pr_warning(ctx->client, "node didn't acknowledge stop");
+	return false;
+}
+
+/* returns true if the node went back to the pool */
+static bool pool_release(struct td_context *ctx)
+{
+	struct td_pool_node *n = ctx->pool_node, **p;
+	bool keep;
+
+	/* the node may report an error while stopping */
+	keep = !ctx->dsp_error && wait_for_stop(ctx) && !ctx->dsp_error;
+
+	pthread_mutex_lock(&pool_lock);
+	for (p = &pool; *p; p = &(*p)->next)
+		if (*p == n)
+			break;
+	if (!*p)
+		keep = false;
+	else if (keep)
+		n->busy = false;
+	else
+		*p = n->next;
+	pthread_mutex_unlock(&pool_lock);
+
+	ctx->pool_node = NULL;
+
+	if (keep) {
+		pr_info(ctx->client, "dsp node returned to pool");
+		return true;
+	}
+
+	/* the context terminates the node itself */
+	session_put(n->session, ctx->client, ctx->dsp_error);
+	free(n);
+	return false;
+}
+
+static void *vdec_create_node(struct td_context *ctx)
+{
+	struct td_codec *codec;
+	struct dsp_node *node;
+	void *arg_data;
+
+	codec = ctx->codec;
+	if (!codec) {
+		pr_err(ctx->client, "unknown algorithm");
+		return NULL;
+	}
+
+	codec->create_args(ctx, &ctx->profile_id, &arg_data);
+	if (!arg_data)
+		return NULL;
+
+	ctx->pool_node = pool_take(ctx, arg_data);
+	if (ctx->pool_node) {
+		node = ctx->pool_node->node;
+		pr_info(ctx->client, "dsp node taken from pool");
+	} else {
+		node = allocate_node(ctx, arg_data);
+	}
+
+	if (!node) {
+		free(arg_data);
+		return NULL;
+	}
+
+	/* to tell whether td_reconfigure() fits */
+	ctx->node_args = arg_data;
+
+	if (codec->setup_params)
+		codec->setup_params(ctx);
+
+	if (codec->send_params)
+		codec->send_params(ctx, node);
+
+	return node;
+}
+
+static inline size_t port_buffer_size(struct td_context *ctx, struct td_port *p)
+{
+	return p->id == 0 ? ctx->input_buffer_size : ctx->output_buffer_size;
+}
+
+static dmm_buffer_t *frame_buffer_new(struct td_context *ctx, struct td_port *p)
+{
+	size_t size = port_buffer_size(ctx, p);
+	size_t pool_size;
+	dmm_buffer_t *b;
+	bool pooling;
+
+	pthread_mutex_lock(&buffer_pool_lock);
+	pooling = buffer_pool.limit != 0;
+	pthread_mutex_unlock(&buffer_pool_lock);
+
+	if (!pooling) {
+		b = dmm_buffer_new(ctx->dsp_handle, ctx->proc, p->dir);
+		b->arena = ctx->arena;
+		b->huge = ctx->huge_pages;
+		dmm_buffer_allocate(b, size);
+		return b;
+	}
+
+	b = buffer_pool_get(p->dir, size, ctx->huge_pages);
+	if (b) {
+		/* start over, keeping only the memory */
+		void *data = b->allocated_data;
+		size_t mmap_size = b->mmap_size;
+
+		pool_size = b->pool_size;
+		memset(b, 0, sizeof(*b));
+		b->data = b->allocated_data = data;
+		b->mmap_size = mmap_size;
+		b->handle = ctx->dsp_handle;
+		b->proc = ctx->proc;
+		b->dir = p->dir;
+		b->read_end = (size_t) -1;
+	} else {
+		pool_size = buffer_pool_class(size);
+		b = dmm_buffer_new(ctx->dsp_handle, ctx->proc, p->dir);
+		b->huge = ctx->huge_pages;
+		dmm_buffer_allocate(b, pool_size);
+	}
+	b->arena = ctx->arena;
+	b->huge = ctx->huge_pages;
+	b->pool_size = pool_size;
+	/* as dmm_buffer_allocate() would for this size */
+	b->size = p->dir == DMA_TO_DEVICE ? size : ROUND_UP(size, 128);
+	b->len = size;
+
+	return b;
+}
+
+static inline void setup_buffers(struct td_context *ctx)
+{
+	struct td_port *p;
+	unsigned i;
+
+	/* comm and params exist for all of max_buffers; only depth are in use */
+	p = ctx->ports[0];
+	p->nr_buffers = p->depth;
+	for (i = 0; i < p->nr_buffers; i++)
+		p->buffers[i].data = frame_buffer_new(ctx, p);
+
+	p = ctx->ports[1];
+	p->nr_buffers = p->depth;
+	for (i = 0; i < p->nr_buffers; i++) {
+		struct td_buffer *tb = &p->buffers[i];
+		tb->data = frame_buffer_new(ctx, p);
+		td_send_buffer(ctx, tb);
+	}
+}
+
+static bool send_play_message(struct td_context *ctx)
+{
+	return dsp_send_message(ctx->dsp_handle, ctx->node, 0x0100, 0, 0);
+};
+
+/*
+ * All the usn_comm blocks of a context live in one page aligned slab,
+ * mapped once, each on its own cache lines.
+ */
+#define TD_COMM_SLOT ROUND_UP(sizeof(usn_comm_t), TD_CACHE_ALIGN)
+
+static inline size_t comm_slab_size(struct td_context *ctx)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		count += ctx->ports[i]->max_buffers;
+
+	return count * TD_COMM_SLOT;
+}
+
+static bool setup_comm(struct td_context *ctx)
+{
+	size_t slot = TD_COMM_SLOT;
+	dmm_buffer_t *slab;
+	unsigned i, count = 0;
+
+	slab = slab_new(ctx, comm_slab_size(ctx), DMA_BIDIRECTIONAL);
+	if (!slab) {
+		pr_err(ctx->client, "failed to allocate comm slab");
+		return false;
+	}
+	slab->arena = ctx->arena;
+	dmm_buffer_map(slab);
+	ctx->comm_slab = slab;
+
+	count = 0;
 	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
 		struct td_port *p = ctx->ports[i];
 		unsigned j;
-		for (j = 0; j < p->nr_buffers; j++) {
-			struct td_buffer *tb = &p->buffers[j];
-			tb->comm = dmm_buffer_new(ctx->dsp_handle, ctx->proc, DMA_BIDIRECTIONAL);
-			dmm_buffer_allocate(tb->comm, sizeof(*tb->comm));
-			dmm_buffer_map(tb->comm);
+		for (j = 0; j < p->max_buffers; j++)
+			p->buffers[j].comm = dmm_buffer_slice(slab, count++ * slot, sizeof(usn_comm_t));
+	}
+
+	return true;
+}
+
+static void free_comm(struct td_context *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		struct td_port *p = ctx->ports[i];
+		unsigned j;
+		for (j = 0; j < p->max_buffers; j++) {
+			dmm_buffer_free(p->buffers[j].comm);
+			p->buffers[j].comm = NULL;
 		}
 	}
 
+	dmm_buffer_free(ctx->comm_slab);
+	ctx->comm_slab = NULL;
+}
+
+static bool _dsp_start(struct td_context *ctx)
+{
+	bool ret = true;
+
+	if (!setup_comm(ctx))
+		return false;
+
+	if (ctx->pool_node) {
+		/* already running */
+		ctx->events[0] = ctx->pool_node->event;
+		goto registered;
+	}
+
 	if (!dsp_node_run(ctx->dsp_handle, ctx->node)) {
 		pr_err(ctx->client, "dsp node run failed");
 		return false;
@@ -333,6 +1214,8 @@ static bool _dsp_start(struct td_context *ctx)
 		return false;
 	}
 
+registered:
+
 	ctx->events[1] = calloc(1, sizeof(struct dsp_notification));
 	if (!dsp_register_notify(ctx->dsp_handle, ctx->proc,
 				DSP_MMUFAULT, 1,
@@ -360,18 +1243,232 @@ static bool _dsp_start(struct td_context *ctx)
 	return ret;
 }
 
+static inline void record_latency(struct td_port *p, uint64_t turnaround)
+{
+	unsigned bucket = hist_bucket(turnaround);
+
+	if (bucket >= TD_LATENCY_BUCKETS)
+		bucket = TD_LATENCY_BUCKETS - 1;
+	p->latency[bucket]++;
+	p->latency_count++;
+	if (turnaround > p->latency_max)
+		p->latency_max = turnaround;
+
+	/* sampled before this one leaves */
+	p->occupancy_sum += p->queued * 100 / p->nr_buffers;
+	if (p->queued)
+		p->queued--;
+}
+
+static void reset_latency_stats(struct td_port *p)
+{
+	memset(p->latency, 0, sizeof(p->latency));
+	p->latency_count = p->latency_max = 0;
+	p->queued = p->max_queued = 0;
+	p->occupancy_sum = 0;
+}
+
+static unsigned latency_percentile(struct td_port *p, unsigned percent)
+{
+	unsigned i, count = 0, target;
+
+	target = ((uint64_t) p->latency_count * percent + 99) / 100;
+	for (i = 0; i < TD_LATENCY_BUCKETS; i++) {
+		count += p->latency[i];
+		if (count >= target)
+			break;
+	}
+
+	if (i >= TD_LATENCY_BUCKETS - 1)
+		return p->latency_max;
+
+	return hist_value(i) < p->latency_max ? hist_value(i) : p->latency_max;
+}
+
+bool td_get_latency_stats(struct td_context *ctx, unsigned port,
+		struct td_latency_stats *stats)
+{
+	struct td_port *p;
+
+	if (port >= ARRAY_SIZE(ctx->ports))
+		return false;
+
+	p = ctx->ports[port];
+
+	memset(stats, 0, sizeof(*stats));
+	stats->queued = p->queued;
+	stats->max_queued = p->max_queued;
+
+	if (!p->latency_count)
+		return true;
+
+	stats->count = p->latency_count;
+	stats->p50 = latency_percentile(p, 50);
+	stats->p99 = latency_percentile(p, 99);
+	stats->max = p->latency_max;
+	stats->occupancy = p->occupancy_sum / p->latency_count;
+
+	return true;
+}
+
+unsigned td_get_latency(struct td_context *ctx, unsigned frame_duration)
+{
+	struct td_codec *codec = ctx->codec;
+	unsigned latency;
+
+	if (codec && codec->get_latency)
+		return codec->get_latency(ctx, frame_duration);
+
+	latency = latency_percentile(ctx->ports[1], 99);
+	return latency > frame_duration ? latency : frame_duration;
+}
+
+static void setup_arena(struct td_context *ctx)
+{
+	size_t size = ctx->arena_size;
+
+	if (!size) {
+		size_t largest = 0;
+		unsigned i;
+
+		for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+			struct td_port *p = ctx->ports[i];
+			size_t slot = map_size(port_buffer_size(ctx, p));
+
+			if (ctx->huge_pages)
+				slot += DSP_SECTION_SIZE;
+			size += p->max_buffers * slot;
+			if (slot > largest)
+				largest = slot;
+
+			if (p->params_slab)
+				size += map_size(p->params_slab->size);
+		}
+
+		/* cached mappings outlive the buffers they were made for */
+		size += ctx->map_cache_size * largest;
+
+		size += map_size(comm_slab_size(ctx));
+	}
+
+	ctx->arena = dmm_arena_new(ctx->dsp_handle, ctx->proc, size);
+	if (!ctx->arena)
+		pr_warning(ctx->client, "no DSP arena; reserving per buffer");
+}
+
+static void free_arena(struct td_context *ctx)
+{
+	dmm_arena_free(ctx->arena);
+	ctx->arena = NULL;
+}
+
+bool td_get_arena_stats(struct td_context *ctx, struct td_arena_stats *stats)
+{
+	if (!ctx->arena)
+		return false;
+
+	dmm_arena_get_stats(ctx->arena, stats);
+	return true;
+}
+
+static void setup_depth(struct td_context *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		struct td_port *p = ctx->ports[i];
+		unsigned max;
+
+		if (!p->depth)
+			p->depth = ctx->codec->depth ? ctx->codec->depth : 2;
+
+		max = p->depth;
+		if (ctx->auto_depth_limit) {
+			size_t fit = ctx->auto_depth_limit / ARRAY_SIZE(ctx->ports) /
+				port_buffer_size(ctx, p);
+			if (fit > TD_MAX_DEPTH)
+				fit = TD_MAX_DEPTH;
+			if (fit > max)
+				max = fit;
+		}
+
+		/* the node is told about all of them */
+		td_port_alloc_buffers(p, max);
+		reset_latency_stats(p);
+	}
+}
+
+/*
+ * Auto depth: if a port had no buffer left on the DSP when this one came
+ * back, and the application holds buffers longer than the DSP takes to
+ * turn them around, add another one, within auto_depth_limit.
+ */
+static void auto_depth(struct td_context *ctx, struct td_port *p)
+{
+	struct td_buffer *tb;
+	unsigned i, queued = 0, target;
+	size_t total = 0;
+
+	if (p->nr_buffers >= p->max_buffers || !p->turnaround)
+		return;
+
+	for (i = 0; i < p->nr_buffers; i++)
+		if (p->buffers[i].used)
+			queued++;
+	if (queued)
+		return;
+
+	target = 1 + (p->hold_time + p->turnaround - 1) / p->turnaround;
+	if (target <= p->nr_buffers)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		total += ctx->ports[i]->nr_buffers * port_buffer_size(ctx, ctx->ports[i]);
+	if (total + port_buffer_size(ctx, p) > ctx->auto_depth_limit)
+		return;
+
+	tb = &p->buffers[p->nr_buffers++];
+	tb->data = frame_buffer_new(ctx, p);
+
+	pr_info(ctx->client, "port %u depth %u (dsp %u us, app %u us)",
+			p->id, p->nr_buffers, p->turnaround, p->hold_time);
+
+	if (p->id == 1)
+		td_send_buffer(ctx, tb);
+}
+
+/* raw frames both ways, unless the codec knows better */
+static void setup_buffer_sizes(struct td_context *ctx)
+{
+	struct td_codec *codec = ctx->codec;
+
+	ctx->input_buffer_size = ctx->width * ctx->height * 3 / 2;
+	ctx->output_buffer_size = ctx->input_buffer_size;
+	if (codec->setup_buffer_sizes)
+		codec->setup_buffer_sizes(ctx);
+}
+
 static inline bool init_node(struct td_context *ctx)
 {
-	ctx->output_buffer_size = ctx->width * ctx->height * 3 / 2;
-	if (!ctx->output_buffer_size)
+	unsigned i;
+
+	setup_buffer_sizes(ctx);
+	if (!ctx->input_buffer_size || !ctx->output_buffer_size)
 		return false;
 
+	setup_depth(ctx);
+
 	ctx->node = ctx->create_node(ctx);
 	if (!ctx->node) {
 		pr_err(ctx->client, "dsp node creation failed");
 		return false;
 	}
 
+	/* sized for the params the codec set up */
+	setup_arena(ctx);
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		map_params(ctx, ctx->ports[i]);
+
 	if (!_dsp_start(ctx)) {
 		pr_err(ctx->client, "dsp start failed");
 		return false;
@@ -380,28 +1477,35 @@ static inline bool init_node(struct td_context *ctx)
 	return true;
 }
 
+static bool _dsp_stop(struct td_context *ctx);
+
 bool td_init(struct td_context *ctx)
 {
-	int dsp_handle;
+	/* the buffer sizes and depths already come from the codec */
+	if (!ctx->codec) {
+		pr_err(ctx->client, "unknown algorithm");
+		return false;
+	}
 
 	ctx->create_node = vdec_create_node;
 	ctx->send_play_message = send_play_message;
-	ctx->color_format = td_fourcc('I', '4', '2', '0');
-
-	ctx->dsp_handle = dsp_handle = dsp_open();
+	if (!ctx->color_format)
+		ctx->color_format = td_fourcc('I', '4', '2', '0');
 
-	if (dsp_handle < 0) {
-		pr_err(ctx->client, "dsp open failed");
+	ctx->session = session_get(ctx);
+	if (!ctx->session) {
+		ctx->dsp_handle = -1;
 		return false;
 	}
 
-	if (!dsp_attach(dsp_handle, 0, NULL, &ctx->proc)) {
-		pr_err(ctx->client, "dsp attach failed");
-		goto fail;
-	}
+	ctx->dsp_handle = ctx->session->handle;
+	ctx->proc = ctx->session->proc;
 
-	td_port_alloc_buffers(ctx->ports[0], 2);
-	td_port_alloc_buffers(ctx->ports[1], 2);
+	if (ctx->map_cache_size) {
+		ctx->map_cache = map_cache_new(ctx->map_cache_size);
+		if (!ctx->map_cache)
+			pr_warning(ctx->client, "failed to allocate mapping cache");
+	}
 
 	if (!init_node(ctx)) {
 		pr_err(ctx->client, "dsp node init failed");
@@ -411,21 +1515,95 @@ bool td_init(struct td_context *ctx)
 	return true;
 
 fail:
-	if (ctx->proc) {
-		if (!dsp_detach(dsp_handle, ctx->proc))
-			pr_err(ctx->client, "dsp detach failed");
-		ctx->proc = NULL;
-	}
+	/* everything mapped from the arena has to go before it */
+	if (ctx->node) {
+		_dsp_stop(ctx);
+	} else {
+		unsigned i;
 
-	if (ctx->dsp_handle >= 0) {
-		if (dsp_close(dsp_handle) < 0)
-			pr_err(ctx->client, "dsp close failed");
-		ctx->dsp_handle = -1;
+		for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+			td_port_alloc_buffers(ctx->ports[i], 0);
+		map_cache_free(ctx);
+		free_arena(ctx);
 	}
 
+	session_put(ctx->session, ctx->client, ctx->dsp_error);
+	ctx->session = NULL;
+	ctx->proc = NULL;
+	ctx->dsp_handle = -1;
+
 	return false;
 }
 
+bool td_node_pool_prepare(struct td_codec *codec, int width, int height, unsigned count)
+{
+	struct td_context *ctx;
+	bool ret = true;
+
+	ctx = td_new(NULL);
+	if (!ctx)
+		return false;
+
+	ctx->codec = codec;
+	ctx->width = width;
+	ctx->height = height;
+	ctx->color_format = td_fourcc('I', '4', '2', '0');
+
+	ctx->session = session_get(ctx);
+	if (!ctx->session) {
+		td_free(ctx);
+		return false;
+	}
+
+	ctx->dsp_handle = ctx->session->handle;
+	ctx->proc = ctx->session->proc;
+
+	setup_buffer_sizes(ctx);
+	setup_depth(ctx);
+
+	while (count--) {
+		struct td_pool_node *n;
+
+		n = pool_node_new(ctx);
+		if (!n) {
+			ret = false;
+			break;
+		}
+
+		pthread_mutex_lock(&pool_lock);
+		n->next = pool;
+		pool = n;
+		pthread_mutex_unlock(&pool_lock);
+	}
+
+	session_put(ctx->session, NULL, false);
+	td_free(ctx);
+
+	return ret;
+}
+
+void td_node_pool_drain(void)
+{
+	struct td_pool_node *n, *next, *idle = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	for (n = pool; n; n = next) {
+		next = n->next;
+		/* busy ones are terminated by their context */
+		if (n->busy)
+			continue;
+		n->next = idle;
+		idle = n;
+	}
+	pool = NULL;
+	pthread_mutex_unlock(&pool_lock);
+
+	for (n = idle; n; n = next) {
+		next = n->next;
+		pool_node_free(n, NULL);
+	}
+}
+
 static inline bool destroy_node(struct td_context *ctx)
 {
 	if (ctx->node) {
@@ -440,28 +1618,32 @@ static inline bool destroy_node(struct td_context *ctx)
 	return true;
 }
 
+static void stop_watcher(struct td_context *ctx);
+
 static bool _dsp_stop(struct td_context *ctx)
 {
 	unsigned long exit_status;
+	bool pooled = false;
 	unsigned i;
 
 	if (!ctx->node)
 		return true;
 
-	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
-		td_port_flush(ctx->ports[i]);
-
 	dsp_send_message(ctx->dsp_handle, ctx->node, 0x0200, 0, 0);
 
-	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
-		unsigned j;
-		struct td_port *port = ctx->ports[i];
-		for (j = 0; j < port->nr_buffers; j++) {
-			dmm_buffer_free(port->buffers[j].params);
-			port->buffers[j].params = NULL;
-		}
+	/* the stop reply wakes it up */
+	stop_watcher(ctx);
+
+	if (ctx->pool_node) {
+		pooled = pool_release(ctx);
+		/* the notification belongs to the pooled node */
+		if (pooled)
+			ctx->events[0] = NULL;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		free_params(ctx->ports[i]);
+
 	for (i = 0; i < ARRAY_SIZE(ctx->events); i++) {
 		free(ctx->events[i]);
 		ctx->events[i] = NULL;
@@ -472,61 +1654,208 @@ static bool _dsp_stop(struct td_context *ctx)
 		ctx->alg_ctrl = NULL;
 	}
 
-	if (ctx->dsp_error)
+	if (ctx->dsp_error || pooled)
 		goto leave;
 
-	if (!dsp_node_terminate(ctx->dsp_handle, ctx->node, &exit_status))
-		pr_err(ctx->client, "dsp node terminate failed: 0x%lx", exit_status);
+	if (!dsp_node_terminate(ctx->dsp_handle, ctx->node, &exit_status))
+		pr_err(ctx->client, "dsp node terminate failed: 0x%lx", exit_status);
+
+leave:
+	if (!pooled && !destroy_node(ctx))
+		pr_err(ctx->client, "dsp node destroy failed");
+
+	/*
+	 * Only now the node can't touch the buffers anymore; it either
+	 * acknowledged the stop or is gone.
+	 */
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		struct td_port *p = ctx->ports[i];
+		unsigned j;
+		p->nr_buffers = p->max_buffers;
+		for (j = 0; j < p->nr_buffers; j++) {
+			struct td_buffer *tb = &p->buffers[j];
+			if (tb->map_entry)
+				map_cache_put(tb, tb->data);
+		}
+		td_port_flush(p);
+	}
+
+	ctx->node = NULL;
+	free(ctx->node_args);
+	ctx->node_args = NULL;
+
+	free_comm(ctx);
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		td_port_alloc_buffers(ctx->ports[i], 0);
+
+	map_cache_free(ctx);
+	free_arena(ctx);
+
+	pr_info(ctx->client, "dsp node terminated");
+
+	return true;
+}
+
+bool td_close(struct td_context *ctx)
+{
+	bool ret = true;
+
+	_dsp_stop(ctx);
+
+	if (ctx->session) {
+		ret = session_put(ctx->session, ctx->client, ctx->dsp_error);
+		ctx->session = NULL;
+	}
+
+	ctx->proc = NULL;
+	ctx->dsp_handle = -1;
+
+	return ret;
+}
+
+/* takes back the buffers the node returned while stopping */
+static void reclaim_buffers(struct td_context *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		struct td_port *p = ctx->ports[i];
+		unsigned j;
+		for (j = 0; j < p->nr_buffers; j++) {
+			struct td_buffer *tb = &p->buffers[j];
+			if (!tb->used)
+				continue;
+			if (tb->map_entry)
+				map_cache_put(tb, tb->data);
+			else if (!tb->pinned)
+				dmm_buffer_unmap(tb->data);
+			tb->used = false;
+		}
+		p->queued = 0;
+	}
+}
+
+/* reallocates the buffers that are too small, or much too big */
+static void resize_buffers(struct td_context *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		struct td_port *p = ctx->ports[i];
+		size_t size = port_buffer_size(ctx, p);
+		unsigned j;
+		for (j = 0; j < p->nr_buffers; j++) {
+			struct td_buffer *tb = &p->buffers[j];
+			dmm_buffer_t *b = tb->data;
+
+			if (b && b->size >= size && b->size / 2 < size)
+				continue;
+
+			if (b) {
+				td_map_cache_forget(ctx, b->data);
+				buffer_pool_put(b);
+			}
+
+			tb->data = b = frame_buffer_new(ctx, p);
+			if (tb->pinned)
+				dmm_buffer_map(b);
+		}
+	}
+}
+
+/* whether the node would be created the same way for the current size */
+static bool node_fits(struct td_context *ctx)
+{
+	unsigned nr_buffers[ARRAY_SIZE(ctx->ports)];
+	unsigned profile_id, i;
+	void *arg_data;
+	bool fits;
+
+	/* the node was told about all of the buffers */
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
+		nr_buffers[i] = ctx->ports[i]->nr_buffers;
+		ctx->ports[i]->nr_buffers = ctx->ports[i]->max_buffers;
+	}
+
+	ctx->codec->create_args(ctx, &profile_id, &arg_data);
+
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		ctx->ports[i]->nr_buffers = nr_buffers[i];
+
+	if (!arg_data)
+		return false;
+
+	fits = profile_id == ctx->profile_id &&
+		args_size(arg_data) == args_size(ctx->node_args) &&
+		memcmp(arg_data, ctx->node_args, args_size(arg_data)) == 0;
+	free(arg_data);
 
-leave:
-	if (!destroy_node(ctx))
-		pr_err(ctx->client, "dsp node destroy failed");
+	return fits;
+}
 
-	ctx->node = NULL;
+/* the params may depend on the size; they are set up again for all the buffers */
+static void reset_params(struct td_context *ctx)
+{
+	unsigned nr_buffers[ARRAY_SIZE(ctx->ports)];
+	unsigned i;
 
 	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++) {
 		struct td_port *p = ctx->ports[i];
-		unsigned j;
-		for (j = 0; j < p->nr_buffers; j++) {
-			dmm_buffer_free(p->buffers[j].comm);
-			p->buffers[j].comm = NULL;
-		}
-		td_port_alloc_buffers(p, 0);
+		nr_buffers[i] = p->nr_buffers;
+		p->nr_buffers = p->max_buffers;
+		free_params(p);
 	}
 
-	pr_info(ctx->client, "dsp node terminated");
+	if (ctx->codec->setup_params)
+		ctx->codec->setup_params(ctx);
 
-	return true;
+	for (i = 0; i < ARRAY_SIZE(ctx->ports); i++)
+		ctx->ports[i]->nr_buffers = nr_buffers[i];
 }
 
-bool td_close(struct td_context *ctx)
+bool td_reconfigure(struct td_context *ctx, int width, int height)
 {
-	bool ret = true;
+	int old_width = ctx->width, old_height = ctx->height;
+	struct td_port *p;
+	unsigned i;
 
-	_dsp_stop(ctx);
+	if (!ctx->node || ctx->dsp_error)
+		return false;
 
-	if (ctx->dsp_error)
-		goto leave;
+	ctx->width = width;
+	ctx->height = height;
 
-	if (ctx->proc) {
-		if (!dsp_detach(ctx->dsp_handle, ctx->proc)) {
-			pr_err(ctx->client, "dsp detach failed");
-			ret = false;
-		}
-		ctx->proc = NULL;
+	if (!node_fits(ctx)) {
+		pr_info(ctx->client, "%ix%i doesn't fit the node", width, height);
+		goto fail;
 	}
 
-leave:
+	/* frames in flight are dropped */
+	dsp_send_message(ctx->dsp_handle, ctx->node, 0x0200, 0, 0);
+	if (!wait_for_stop(ctx) || ctx->dsp_error)
+		goto fail;
 
-	if (ctx->dsp_handle >= 0) {
-		if (dsp_close(ctx->dsp_handle) < 0) {
-			pr_err(ctx->client, "dsp close failed");
-			ret = false;
-		}
-		ctx->dsp_handle = -1;
-	}
+	reclaim_buffers(ctx);
 
-	return ret;
+	setup_buffer_sizes(ctx);
+	resize_buffers(ctx);
+	reset_params(ctx);
+
+	pr_info(ctx->client, "reconfigured to %ix%i", width, height);
+
+	ctx->send_play_message(ctx);
+
+	p = ctx->ports[1];
+	for (i = 0; i < p->nr_buffers; i++)
+		td_send_buffer(ctx, &p->buffers[i]);
+
+	return true;
+
+fail:
+	ctx->width = old_width;
+	ctx->height = old_height;
+	return false;
 }
 
 static void td_got_error(struct td_context *ctx, unsigned id, const char *message)
@@ -579,9 +1908,18 @@ static inline void got_message(struct td_context *ctx, struct dsp_msg *msg)
 
 		BUG_ON(b->len > b->size, ctx->client, "wrong buffer size");
 
-		if (tb->pinned)
+		trace(TRACE_RECV, ctx, p->id, b->len);
+
+		if (tb->pinned) {
+			/* it stays mapped, so the invalidate can wait */
+			if (p->lazy_invalidate)
+				tb->stale = true;
+			else
+				dmm_buffer_end(b, b->len);
+		} else if (tb->map_entry) {
 			dmm_buffer_end(b, b->len);
-		else
+			map_cache_put(tb, b);
+		} else
 			dmm_buffer_unmap(b);
 
 		param = (void *) msg_data->param_virt;
@@ -592,6 +1930,12 @@ static inline void got_message(struct td_context *ctx, struct dsp_msg *msg)
 			p->recv_cb(ctx, tb);
 
 		tb->used = false;
+		tb->recv_time = now_us();
+		ewma(&p->turnaround, tb->recv_time - tb->send_time);
+		record_latency(p, tb->recv_time - tb->send_time);
+
+		if (ctx->auto_depth_limit)
+			auto_depth(ctx, p);
 
 		if (ctx->handle_buffer)
 			ctx->handle_buffer(ctx, tb);
@@ -631,10 +1975,47 @@ static inline void got_message(struct td_context *ctx, struct dsp_msg *msg)
 	}
 }
 
+/* returns false if the budget ran out before the queue did */
+static inline bool drain_messages(struct td_context *ctx, unsigned budget)
+{
+	struct dsp_msg msg;
+
+	while (budget--) {
+		if (!dsp_node_get_message(ctx->dsp_handle, ctx->node, &msg, 0))
+			return true;
+		pr_debug(ctx->client, "got dsp message: 0x%0x 0x%0x 0x%0x",
+				msg.cmd, msg.arg_1, msg.arg_2);
+		trace(TRACE_MESSAGE, ctx, 0, msg.cmd);
+		got_message(ctx, &msg);
+	}
+
+	return false;
+}
+
+static void handle_event(struct td_context *ctx, unsigned index)
+{
+	switch (index) {
+	case 0:
+		drain_messages(ctx, -1);
+		break;
+	case 1:
+		td_got_error(ctx, DSP_MMUFAULT, "DSP MMU fault");
+		break;
+	case 2:
+		td_got_error(ctx, DSP_SYSERROR, "DSP system error");
+		break;
+	}
+}
+
+static bool get_watched_event(struct td_context *ctx);
+
 bool td_get_event(struct td_context *ctx)
 {
 	unsigned index = 0;
 
+	if (ctx->watcher)
+		return get_watched_event(ctx);
+
 	pr_debug(ctx->client, "waiting for events");
 
 	if (!dsp_wait_for_events(ctx->dsp_handle, ctx->events, 3, &index, 100)) {
@@ -646,16 +2027,491 @@ bool td_get_event(struct td_context *ctx)
 		return true;
 	}
 
-	if (index == 0) {
-		struct dsp_msg msg;
-		while (true) {
-			if (!dsp_node_get_message(ctx->dsp_handle, ctx->node, &msg, 0))
-				break;
-			pr_debug(ctx->client, "got dsp message: 0x%0x 0x%0x 0x%0x",
-					msg.cmd, msg.arg_1, msg.arg_2);
-			got_message(ctx, &msg);
+	handle_event(ctx, index);
+
+	return true;
+}
+
+/*
+ * Reactor; waits for the events of many contexts at once. The bridge
+ * reports only the first signaled event in the array, so the contexts are
+ * rotated after each wake up, and each context is serviced at most
+ * TD_REACTOR_BUDGET messages at a time; the rest is left as backlog for
+ * the next round. MMU faults and system errors concern the whole
+ * processor; they are registered once and reported to every context.
+ */
+
+#define TD_REACTOR_MAX_EVENTS 32 /* MGR_WAIT limit */
+#define TD_REACTOR_MAX (TD_REACTOR_MAX_EVENTS - 2)
+#define TD_REACTOR_BUDGET 4
+
+struct td_reactor {
+	struct td_context *contexts[TD_REACTOR_MAX];
+	bool backlog[TD_REACTOR_MAX];
+	unsigned nr_contexts;
+	unsigned next;
+	int dsp_handle;
+	struct dsp_notification *proc_events[2];
+	struct dsp_notification *events[TD_REACTOR_MAX_EVENTS + 1];
+};
+
+struct td_reactor *td_reactor_new(void)
+{
+	return calloc(1, sizeof(struct td_reactor));
+}
+
+static void reactor_unregister(struct td_reactor *r)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(r->proc_events); i++) {
+		free(r->proc_events[i]);
+		r->proc_events[i] = NULL;
+	}
+}
+
+void td_reactor_free(struct td_reactor *r)
+{
+	if (!r)
+		return;
+
+	reactor_unregister(r);
+	free(r);
+}
+
+static bool reactor_register(struct td_reactor *r, struct td_context *ctx)
+{
+	const unsigned types[] = { DSP_MMUFAULT, DSP_SYSERROR };
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++) {
+		r->proc_events[i] = calloc(1, sizeof(struct dsp_notification));
+		if (!dsp_register_notify(ctx->dsp_handle, ctx->proc,
+					types[i], 1,
+					r->proc_events[i]))
+		{
+			pr_err(ctx->client, "failed to register for processor events");
+			reactor_unregister(r);
+			return false;
+		}
+	}
+
+	r->dsp_handle = ctx->dsp_handle;
+	return true;
+}
+
+bool td_reactor_add(struct td_reactor *r, struct td_context *ctx)
+{
+	if (r->nr_contexts >= TD_REACTOR_MAX) {
+		pr_err(ctx->client, "reactor full");
+		return false;
+	}
+
+	if (!ctx->node || ctx->watcher) {
+		pr_err(ctx->client, "context not running, or already watched");
+		return false;
+	}
+
+	/* all the events are waited on through one handle */
+	if (!r->proc_events[0]) {
+		if (!reactor_register(r, ctx))
+			return false;
+	} else if (ctx->dsp_handle != r->dsp_handle) {
+		pr_err(ctx->client, "context on another DSP session");
+		return false;
+	}
+
+	r->backlog[r->nr_contexts] = false;
+	r->contexts[r->nr_contexts++] = ctx;
+	return true;
+}
+
+static void reactor_erase(struct td_reactor *r, struct td_context *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < r->nr_contexts; i++) {
+		if (r->contexts[i] != ctx)
+			continue;
+		r->nr_contexts--;
+		memmove(&r->contexts[i], &r->contexts[i + 1],
+				(r->nr_contexts - i) * sizeof(*r->contexts));
+		memmove(&r->backlog[i], &r->backlog[i + 1],
+				(r->nr_contexts - i) * sizeof(*r->backlog));
+		break;
+	}
+
+	if (r->next >= r->nr_contexts)
+		r->next = 0;
+}
+
+void td_reactor_remove(struct td_reactor *r, struct td_context *ctx)
+{
+	reactor_erase(r, ctx);
+
+	/* the next context may come with another handle */
+	if (!r->nr_contexts)
+		reactor_unregister(r);
+}
+
+/*
+ * Waits for the events of all the contexts; on success index is the event
+ * (as in ctx->events), and slot the context for messages. Processor events
+ * are for all of them. The optional wake notification interrupts the wait,
+ * which then fails with EINTR.
+ */
+static bool reactor_wait(struct td_reactor *r, unsigned timeout,
+		struct dsp_notification *wake, unsigned *slot, unsigned *index)
+{
+	unsigned n = r->nr_contexts;
+	unsigned i, start = r->next;
+
+	r->events[0] = r->proc_events[0];
+	r->events[1] = r->proc_events[1];
+	for (i = 0; i < n; i++)
+		r->events[2 + i] = r->contexts[(start + i) % n]->events[0];
+	r->events[2 + n] = wake;
+
+	if (!dsp_wait_for_events(r->dsp_handle, r->events, 2 + n + !!wake, index, timeout))
+		return false;
+
+	if (*index == 2 + n) {
+		errno = EINTR;
+		return false;
+	}
+
+	if (*index < 2) {
+		*index += 1;
+		return true;
+	}
+
+	*slot = (start + *index - 2) % n;
+	*index = 0;
+	r->next = (*slot + 1) % n;
+
+	return true;
+}
+
+bool td_reactor_run(struct td_reactor *r, unsigned timeout)
+{
+	unsigned n = r->nr_contexts;
+	unsigned i, slot, index, start;
+	bool backlog = false;
+
+	if (!n)
+		return false;
+
+	start = r->next;
+
+	for (i = 0; i < n; i++)
+		backlog |= r->backlog[i];
+
+	if (reactor_wait(r, backlog ? 0 : timeout, NULL, &slot, &index)) {
+		if (index)
+			for (i = 0; i < n; i++)
+				handle_event(r->contexts[i], index);
+		else
+			r->backlog[slot] = true;
+	} else if (errno != ETIME) {
+		pr_err(NULL, "failed waiting for events: %i", errno);
+		return true;
+	} else if (!backlog) {
+		return false;
+	}
+
+	for (i = 0; i < n; i++) {
+		slot = (start + i) % n;
+		if (r->backlog[slot])
+			r->backlog[slot] = !drain_messages(r->contexts[slot], TD_REACTOR_BUDGET);
+	}
+
+	return true;
+}
+
+/*
+ * Event watcher; one thread per session waits, through a reactor, for the
+ * DSP notifications of all the contexts that asked for a file descriptor,
+ * and signals the eventfd of each context. Adding or removing a context
+ * wakes the wait through a notification of the watcher's own, so that it
+ * picks up the change; removing one also waits for the wait that might
+ * still use its notifications to finish. The kernel bridge can't signal
+ * notifications from the MPU side, so there the wait times out every
+ * TD_WATCH_RESCAN ms instead.
+ */
+
+#define TD_WATCH_RESCAN 20
+
+struct td_watcher {
+	int fd;
+	unsigned pending;
+};
+
+struct td_watch {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct td_reactor *reactor;
+	struct dsp_notification *wake;
+	unsigned timeout; /* of each wait; 0 until the first context */
+	bool quit;
+	bool waiting;
+	unsigned waits; /* finished */
+};
+
+/* lock must be held */
+static void watch_wake(struct td_watch *w)
+{
+	if (w->wake && w->waiting)
+		dsp_notify(w->reactor->dsp_handle, w->wake);
+}
+
+/* the first notification doubles as a check that it can be signaled */
+static void watch_register(struct td_watch *w, struct td_context *ctx)
+{
+	w->timeout = TD_WATCH_RESCAN;
+
+	w->wake = calloc(1, sizeof(*w->wake));
+	if (!w->wake)
+		return;
+
+	if (dsp_register_notify(ctx->dsp_handle, ctx->proc, DSP_SYSERROR, 1, w->wake) &&
+			dsp_notify(ctx->dsp_handle, w->wake))
+	{
+		w->timeout = -1;
+		return;
+	}
+
+	free(w->wake);
+	w->wake = NULL;
+}
+
+static inline void watcher_signal(struct td_context *ctx, unsigned index)
+{
+	struct td_watcher *w = ctx->watcher;
+	const uint64_t one = 1;
+
+	if (index)
+		__atomic_or_fetch(&w->pending, 1 << index, __ATOMIC_RELEASE);
+	if (write(w->fd, &one, sizeof(one)) < 0)
+		pr_err(ctx->client, "failed to signal event fd");
+}
+
+static void *watch_thread(void *data)
+{
+	struct td_watch *w = data;
+	struct td_reactor snapshot;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->quit) {
+		unsigned i, slot, index;
+		bool ok;
+
+		if (!w->reactor->nr_contexts) {
+			pthread_cond_wait(&w->cond, &w->lock);
+			continue;
+		}
+
+		/* the contexts may change during the wait */
+		snapshot = *w->reactor;
+		w->waiting = true;
+		pthread_mutex_unlock(&w->lock);
+
+		ok = reactor_wait(&snapshot, w->timeout, w->wake, &slot, &index);
+
+		pthread_mutex_lock(&w->lock);
+		w->waiting = false;
+		w->waits++;
+		w->reactor->next = snapshot.next;
+
+		if (ok) {
+			if (index)
+				for (i = 0; i < snapshot.nr_contexts; i++)
+					watcher_signal(snapshot.contexts[i], index);
+			else
+				watcher_signal(snapshot.contexts[slot], 0);
+		} else if (errno != ETIME && errno != EINTR) {
+			/* the contexts are not watched anymore; they have to be closed */
+			for (i = 0; i < snapshot.nr_contexts; i++) {
+				struct td_context *ctx = snapshot.contexts[i];
+				pr_err(ctx->client, "failed waiting for events: %i", errno);
+				ctx->dsp_error = DSP_SYSERROR;
+				watcher_signal(ctx, 0);
+				reactor_erase(w->reactor, ctx);
+			}
 		}
+
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static struct td_watch *watch_new(void)
+{
+	struct td_watch *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->reactor = td_reactor_new();
+	if (!w->reactor)
+		goto fail;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	if (pthread_create(&w->thread, NULL, watch_thread, w) != 0) {
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	td_reactor_free(w->reactor);
+	free(w);
+	return NULL;
+}
+
+static void watch_free(struct td_watch *w)
+{
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = true;
+	watch_wake(w);
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	td_reactor_free(w->reactor);
+	free(w->wake);
+	free(w);
+}
+
+static struct td_watch *session_watch(struct td_session *s)
+{
+	struct td_watch *w;
+
+	pthread_mutex_lock(&session_lock);
+	if (!s->watch)
+		s->watch = watch_new();
+	w = s->watch;
+	pthread_mutex_unlock(&session_lock);
+
+	return w;
+}
+
+int td_get_fd(struct td_context *ctx)
+{
+	struct td_watcher *cw;
+	struct td_watch *w;
+	bool added;
+
+	if (ctx->watcher)
+		return ctx->watcher->fd;
+
+	if (!ctx->node) {
+		pr_err(ctx->client, "no node running");
+		return -1;
+	}
+
+	w = session_watch(ctx->session);
+	if (!w) {
+		pr_err(ctx->client, "failed to create watcher thread");
+		return -1;
+	}
+
+	cw = calloc(1, sizeof(*cw));
+	if (!cw)
+		return -1;
+
+	cw->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (cw->fd < 0) {
+		pr_err(ctx->client, "failed to create event fd");
+		free(cw);
+		return -1;
 	}
 
+	pthread_mutex_lock(&w->lock);
+	/* the wake notification takes one of the events */
+	if (w->wake && w->reactor->nr_contexts >= TD_REACTOR_MAX - 1) {
+		pr_err(ctx->client, "watcher full");
+		added = false;
+	} else {
+		added = td_reactor_add(w->reactor, ctx);
+	}
+	if (added) {
+		ctx->watcher = cw;
+		if (!w->timeout)
+			watch_register(w, ctx);
+		watch_wake(w);
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if (!added) {
+		close(cw->fd);
+		free(cw);
+		return -1;
+	}
+
+	return cw->fd;
+}
+
+static void stop_watcher(struct td_context *ctx)
+{
+	struct td_watcher *cw = ctx->watcher;
+	struct td_watch *w;
+	unsigned waits;
+
+	if (!cw)
+		return;
+
+	w = ctx->session->watch;
+
+	pthread_mutex_lock(&w->lock);
+	reactor_erase(w->reactor, ctx);
+	watch_wake(w);
+	waits = w->waits;
+	while (w->waiting && w->waits == waits)
+		pthread_cond_wait(&w->cond, &w->lock);
+	ctx->watcher = NULL;
+	pthread_mutex_unlock(&w->lock);
+
+	close(cw->fd);
+	free(cw);
+}
+
+static bool get_watched_event(struct td_context *ctx)
+{
+	struct td_watcher *w = ctx->watcher;
+	unsigned pending, i;
+	uint64_t count;
+
+	if (read(w->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		pr_err(ctx->client, "failed to read event fd");
+
+	pending = __atomic_exchange_n(&w->pending, 0, __ATOMIC_ACQUIRE);
+	for (i = 1; i < ARRAY_SIZE(ctx->events); i++)
+		if (pending & (1 << i))
+			handle_event(ctx, i);
+
+	/* messages may have arrived since the notification */
+	handle_event(ctx, 0);
+
 	return true;
 }
+
+void td_use_simulator(unsigned frame_latency)
+{
+	dsp_sim_set_latency(frame_latency);
+	dsp_set_backend(&dsp_sim_backend);
+}
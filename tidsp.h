@@ -18,8 +18,15 @@
 struct td_context;
 struct td_buffer;
 struct td_port;
+struct td_map_entry;
+struct td_map_cache;
+struct td_watcher;
+struct td_reactor;
+struct td_session;
+struct td_pool_node;
 
 struct dmm_buffer;
+struct dmm_arena;
 
 struct dsp_node;
 struct dsp_notification;
@@ -35,7 +42,16 @@ struct dmm_buffer {
 	void *map;
 	bool need_copy;
 	int dir;
-	size_t dma_len;
+	size_t dma_start, dma_len; /* the range begun, with DSP_API 2 */
+	struct dmm_arena *arena;
+	struct dmm_buffer *parent; /* slices share its allocation and mapping */
+	bool huge; /* back big allocations with huge pages */
+	size_t mmap_size; /* allocated_data came from mmap */
+	size_t pool_size; /* allocated for a buffer pool size class */
+	bool tracked; /* cleaning limited to the dirty range */
+	size_t dirty_start, dirty_end;
+	bool read_tracked; /* invalidation limited to the read range */
+	size_t read_start, read_end;
 };
 
 struct td_buffer {
@@ -44,50 +60,112 @@ struct td_buffer {
 	struct dmm_buffer *comm;
 	struct dmm_buffer *params;
 	void *user_data;
+	struct td_map_entry *map_entry;
+	uint64_t send_time, recv_time;
 	bool keyframe;
 	bool pinned;
 	bool clean;
 	bool used;
+	bool stale; /* the CPU cache isn't invalidated yet */
+	unsigned width, height; /* of the image, for codecs where it varies */
+	unsigned frames; /* audio frames packed in the buffer */
+	bool eos; /* input; the last buffer of the stream, for the codecs that care */
 };
 
 typedef void (*td_port_cb_t) (struct td_context *ctx, struct td_buffer *tb);
 
+#define TD_LATENCY_BUCKETS 96
+
 struct td_port {
 	unsigned id;
 	int dir;
 	struct td_buffer *buffers;
+	struct dmm_buffer *params_slab;
 	unsigned nr_buffers;
-	td_port_cb_t send_cb;
+	unsigned max_buffers;
+	unsigned depth;
+	bool lazy_invalidate;
+	bool dirty_params; /* send_cb marks what it changes in the params */
+	unsigned turnaround, hold_time; /* averages in us */
+	unsigned latency[TD_LATENCY_BUCKETS]; /* turnaround histogram */
+	unsigned latency_count, latency_max;
+	unsigned queued, max_queued;
+	uint64_t occupancy_sum;
+	td_port_cb_t send_cb; /* clears tb->clean if it changes the data */
 	td_port_cb_t recv_cb;
 };
 
+enum td_codec_dir {
+	TD_DECODER,
+	TD_ENCODER,
+};
+
 struct td_codec {
+	const char *name;
+	const uint32_t *fourccs; /* zero terminated */
+	int dir; /* enum td_codec_dir */
 	const struct dsp_uuid *uuid;
 	const char *filename;
 	void (*setup_params)(struct td_context *ctx);
 	void (*create_args)(struct td_context *ctx, unsigned *profile_id, void **arg_data);
-	bool (*handle_extra_data)(struct td_context *ctx, void *buf);
+	bool (*handle_extra_data)(struct td_context *ctx, void *buf); /* buf: codec data */
 	void (*flush_buffer)(struct td_context *ctx);
 	void (*send_params)(struct td_context *ctx, struct dsp_node *node);
 	void (*update_params)(struct td_context *ctx, struct dsp_node *node, uint32_t msg);
 	unsigned (*get_latency)(struct td_context *ctx, unsigned frame_duration);
+	/* sets input_buffer_size and output_buffer_size; raw frames otherwise */
+	void (*setup_buffer_sizes)(struct td_context *ctx);
+	unsigned depth; /* default port depth; 2 otherwise */
 };
 
 struct td_context {
 	void *client;
+	struct td_session *session;
 	int dsp_handle;
 	void *proc;
 	struct dsp_node *node;
+	struct td_pool_node *pool_node;
+	unsigned profile_id;
+	void *node_args; /* the node was created with */
 	struct td_codec *codec;
+	void *priv; /* codec private data, freed with the context */
 	struct td_port *ports[2];
 	struct dsp_notification *events[3];
 	struct dmm_buffer *alg_ctrl;
+	struct dmm_buffer *comm_slab;
+	struct td_map_cache *map_cache;
+	struct td_watcher *watcher;
+	struct dmm_arena *arena;
 
 	int width, height;
 	int crop_width, crop_height;
-	unsigned color_format;
+	unsigned color_format; /* fourcc of the raw frames; I420 unless set before td_init() */
+	size_t input_buffer_size;
 	size_t output_buffer_size;
 	unsigned dsp_error;
+	unsigned map_cache_size;
+	size_t arena_size;
+	size_t auto_depth_limit;
+	bool no_mb_info; /* don't read back per-macroblock info, if the codec has it */
+	bool huge_pages; /* frame buffers of 1 MiB or more on huge pages */
+	unsigned priority, timeout; /* of the node; 0 for the defaults */
+	unsigned profile; /* overrides the profile the codec picks, if set */
+	int performance_mode;
+
+	/*
+	 * Encoders; bits per second, frames per second and frames between
+	 * keyframes, 0 for the codec defaults for the frame size. Changes
+	 * while running apply from the next input frame.
+	 */
+	unsigned bitrate, framerate, keyframe_interval;
+	bool force_keyframe; /* encode the next input frame as a keyframe */
+	unsigned frame_index; /* of the next input frame, from 0 after a flush */
+	unsigned quality; /* jpeg encoder, 1 to 100 */
+
+	/* audio; width and height are not used */
+	unsigned rate, channels;
+	unsigned frames_per_buffer; /* 0 for the codec default */
+	unsigned out_rate, out_channels; /* decoded, as the stream reports; 0 until known */
 
 	void *(*create_node)(struct td_context *ctx);
 	bool (*send_play_message)(struct td_context *ctx);
@@ -99,20 +177,197 @@ void td_port_free(struct td_port *p);
 void td_port_alloc_buffers(struct td_port *p, unsigned nr_buffers);
 void td_port_flush(struct td_port *p);
 
+/* initial number of buffers; must be set before td_init() */
+void td_port_set_depth(struct td_port *p, unsigned nr_buffers);
+/* let ports grow while the DSP starves, up to mem_limit bytes of buffers */
+void td_set_auto_depth(struct td_context *ctx, size_t mem_limit);
+
+/*
+ * Node tuning, before td_init(); priority 1 (lowest) to 15, timeout in ms
+ * for the node calls, and the profile instead of the one for the frame
+ * size. 0 restores the default. Such contexts don't take pooled nodes.
+ */
+void td_set_node_priority(struct td_context *ctx, unsigned priority, unsigned timeout);
+void td_set_profile(struct td_context *ctx, unsigned profile_id);
+/*
+ * Throughput (higher) or latency (lower) trade-off of the algorithm; codecs
+ * that take it per frame apply it from the next one, the others ignore it.
+ */
+void td_set_performance_mode(struct td_context *ctx, int mode);
+
+/*
+ * Pinned buffers returned on this output port are not invalidated for the
+ * CPU; call td_buffer_cpu_access() before reading their contents. Input
+ * ports are refused.
+ */
+bool td_port_set_lazy_invalidate(struct td_port *p, bool enable);
+void td_buffer_cpu_access(struct td_buffer *tb);
+
 struct td_context *td_new(void *client);
 void td_free(struct td_context *ctx);
 bool td_send_buffer(struct td_context *ctx, struct td_buffer *tb);
 
+/*
+ * Batched submission; fill puts item index of the batch in a free buffer of
+ * the port, or returns false to stop. Returns how many were sent, the rest
+ * go in later calls, as buffers come back.
+ */
+typedef bool (*td_fill_func)(struct td_context *ctx, struct td_buffer *tb,
+		unsigned index, void *data);
+unsigned td_send_batch(struct td_context *ctx, struct td_port *p, unsigned count,
+		td_fill_func fill, void *data);
+
+/*
+ * With map_cache_size set before td_init(), non-pinned buffers stay mapped
+ * after the DSP returns them. Call this before freeing or reusing such
+ * memory for something else.
+ */
+void td_map_cache_forget(struct td_context *ctx, void *data);
+
 bool td_init(struct td_context *ctx);
 bool td_close(struct td_context *ctx);
 bool td_get_event(struct td_context *ctx);
 
+/*
+ * Changes the frame size of a running context, keeping the node, when the
+ * node would be created the same way for the new size (e.g. within a profile
+ * tier); returns false otherwise, and the context has to be closed and
+ * initialized again. Frames in flight are dropped; all the input buffers are
+ * free afterwards. It also returns false if the node doesn't acknowledge the
+ * stop, or reports an error meanwhile; then the node is left stopped and the
+ * context has to be closed.
+ */
+bool td_reconfigure(struct td_context *ctx, int width, int height);
+
+/*
+ * Returns a file descriptor that becomes readable when there are DSP
+ * events; from then on td_get_event() doesn't block, call it whenever the
+ * fd is readable. One thread per DSP session watches all such contexts; if
+ * it can't wait anymore, dsp_error is set and the fd made readable. Valid
+ * until td_close(). Such contexts can't be added to a reactor.
+ */
+int td_get_fd(struct td_context *ctx);
+
+/*
+ * Services up to thirty running contexts of the same DSP session from one
+ * thread. td_reactor_run() waits up to timeout ms and dispatches to
+ * handle_buffer; returns false if nothing happened.
+ */
+struct td_reactor *td_reactor_new(void);
+void td_reactor_free(struct td_reactor *r);
+bool td_reactor_add(struct td_reactor *r, struct td_context *ctx);
+void td_reactor_remove(struct td_reactor *r, struct td_context *ctx);
+bool td_reactor_run(struct td_reactor *r, unsigned timeout);
+
+/*
+ * Creates and runs count nodes ahead of time for the profile tier of
+ * width x height; td_init() takes one when the codec, tier and port depths
+ * (the default) match, and td_close() gives it back.
+ */
+bool td_node_pool_prepare(struct td_codec *codec, int width, int height, unsigned count);
+/* terminates the idle nodes; nodes in use are terminated on td_close() */
+void td_node_pool_drain(void);
+
+/*
+ * Frame buffers released by td_close() are kept, unmapped, for later
+ * contexts until the pool holds limit bytes; 0, the default, disables it.
+ */
+void td_buffer_pool_set_limit(size_t limit);
+/* frees idle buffers until the pool holds at most size bytes */
+void td_buffer_pool_trim(size_t size);
+
+struct td_buffer_pool_stats {
+	size_t size; /* bytes held */
+	size_t limit;
+	unsigned buffers;
+	unsigned hits, misses;
+};
+
+void td_buffer_pool_get_stats(struct td_buffer_pool_stats *stats);
+
+/* messages above level are not even formatted; 0 errors ... 4 debug */
+void td_set_log_level(unsigned level);
+
+/*
+ * Receives the messages instead of stdout and syslog; object is the
+ * client of the context, which is otherwise printed as a [%p] prefix. Set
+ * it before any context is running.
+ */
+typedef void (*td_log_handler_t)(unsigned level, void *object,
+		const char *file, const char *function, unsigned line,
+		const char *message, void *data);
+void td_set_log_handler(td_log_handler_t handler, void *data);
+
+/*
+ * Messages are formatted by the caller and output from a background
+ * thread; when too many are pending, new ones are dropped and counted.
+ */
+bool td_set_log_async(bool enable);
+unsigned td_get_log_drops(void);
+
+/* hot-path binary trace; decode the dump with tdtrace */
+void td_trace_enable(bool enable);
+bool td_trace_dump(const char *filename);
+
+/* run against the in-process DSP simulator; frame_latency in microseconds */
+void td_use_simulator(unsigned frame_latency);
+
+struct td_arena_stats {
+	size_t size;
+	size_t free;
+	size_t largest_free;
+	unsigned free_blocks;
+	unsigned allocations;
+	unsigned failures; /* slices that didn't fit and were reserved apart */
+	unsigned fragmentation; /* percentage of free space not in the largest block */
+};
+
+bool td_get_arena_stats(struct td_context *ctx, struct td_arena_stats *stats);
+
+struct td_latency_stats {
+	unsigned count; /* buffers returned since td_init() */
+	unsigned p50, p99, max; /* turnaround on the DSP in us */
+	unsigned queued, max_queued; /* buffers on the DSP */
+	unsigned occupancy; /* average percentage of the port buffers on the DSP */
+};
+
+bool td_get_latency_stats(struct td_context *ctx, unsigned port,
+		struct td_latency_stats *stats);
+
+/*
+ * Expected decoding latency in us for frames of frame_duration us; from
+ * the codec if it knows, otherwise the measured output turnaround.
+ */
+unsigned td_get_latency(struct td_context *ctx, unsigned frame_duration);
+
 typedef void (*td_setup_params_func)(struct td_context *ctx, struct dmm_buffer *mb);
 
+/*
+ * The params are flushed once after func, and then whole on every send;
+ * codecs that set dirty_params on the port first only get the ranges they
+ * mark with dmm_buffer_dirty() flushed instead.
+ */
 void td_port_setup_params(struct td_context *ctx, struct td_port *p, size_t size,
 		td_setup_params_func func);
 
 extern struct td_codec td_mp4vdec_codec;
+extern struct td_codec td_h264vdec_codec;
+extern struct td_codec td_mp4venc_codec;
+extern struct td_codec td_h263venc_codec;
+extern struct td_codec td_jpegdec_codec;
+extern struct td_codec td_jpegenc_codec;
+extern struct td_codec td_aacdec_codec;
+extern struct td_codec td_mp3dec_codec;
+
+/*
+ * Codecs for td_codec_find(); the built-in ones, then the ones registered
+ * by the td_codec_plugin_init() of each .so in the codec directory
+ * (TIDSP_CODEC_DIR overrides it), then the application's. The last
+ * registered wins. Plugins build with the libtidsp pkg-config cflags,
+ * which add dsp_bridge.h, dmm_buffer.h and log.h, and go in its codecdir.
+ */
+bool td_codec_register(struct td_codec *codec);
+struct td_codec *td_codec_find(uint32_t fourcc, int dir);
 
 #define td_fourcc(a, b, c, d) \
 	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#include "trace.h"
+#include "tidsp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+struct trace_ring {
+	struct trace_ring *next;
+	uint32_t tid;
+	unsigned head; /* records ever written */
+	struct trace_record records[TRACE_RECORDS];
+};
+
+bool trace_enabled;
+
+/* rings are never freed; a dump may come after their thread is gone */
+static struct trace_ring *rings;
+static __thread struct trace_ring *ring;
+
+static struct trace_ring *ring_new(void)
+{
+	struct trace_ring *r;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->tid = syscall(SYS_gettid);
+
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return r;
+}
+
+void trace_event(unsigned event, const void *object, unsigned port, uint32_t arg)
+{
+	struct trace_ring *r = ring;
+	struct trace_record *rec;
+	unsigned head;
+
+	if (unlikely(!r)) {
+		r = ring = ring_new();
+		if (!r)
+			return;
+	}
+
+	head = r->head;
+	rec = &r->records[head % TRACE_RECORDS];
+	rec->time = now_us();
+	rec->object = (uintptr_t) object;
+	rec->event = event;
+	rec->port = port;
+	rec->arg = arg;
+
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void td_trace_enable(bool enable)
+{
+	trace_enabled = enable;
+}
+
+/*
+ * Rings are read while their threads may still write; the oldest records
+ * of a busy ring can come out torn.
+ */
+bool td_trace_dump(const char *filename)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+	};
+	struct trace_ring *r, *first;
+	FILE *f;
+	bool ret = true;
+
+	f = fopen(filename, "wb");
+	if (!f)
+		return false;
+
+	first = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	for (r = first; r; r = r->next)
+		header.nr_rings++;
+
+	if (fwrite(&header, sizeof(header), 1, f) != 1)
+		ret = false;
+
+	for (r = first; r && ret; r = r->next) {
+		struct trace_ring_header rh;
+		unsigned head, start, i;
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		rh.tid = r->tid;
+		rh.nr_records = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+		start = head - rh.nr_records;
+
+		if (fwrite(&rh, sizeof(rh), 1, f) != 1) {
+			ret = false;
+			break;
+		}
+
+		for (i = 0; i < rh.nr_records; i++) {
+			struct trace_record *rec = &r->records[(start + i) % TRACE_RECORDS];
+			if (fwrite(rec, sizeof(*rec), 1, f) != 1) {
+				ret = false;
+				break;
+			}
+		}
+	}
+
+	if (fclose(f) != 0)
+		ret = false;
+
+	return ret;
+}
+
+static void __attribute__((constructor)) trace_init(void)
+{
+	if (getenv("TIDSP_TRACE"))
+		trace_enabled = true;
+}
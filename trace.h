@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 agent
+ *
+ * Author: agent <agent@local>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Binary trace of hot-path events; each thread writes to its own ring, so
+ * recording is a few stores. td_trace_dump() writes all the rings to a
+ * file that tdtrace decodes.
+ */
+
+enum trace_event {
+	TRACE_SEND,	/* arg: buffer length */
+	TRACE_RECV,	/* arg: buffer length */
+	TRACE_MESSAGE,	/* arg: command */
+	TRACE_MAP,	/* arg: size */
+	TRACE_UNMAP,
+	TRACE_LAST,
+};
+
+#define TRACE_MAGIC 0x52544454 /* "TDTR" */
+#define TRACE_VERSION 1
+#define TRACE_RECORDS 4096
+
+struct trace_record {
+	uint64_t time; /* us, monotonic */
+	uint64_t object;
+	uint16_t event;
+	uint16_t port;
+	uint32_t arg;
+};
+
+/* file layout: header, then per ring a ring header and its records */
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t nr_rings;
+};
+
+struct trace_ring_header {
+	uint32_t tid;
+	uint32_t nr_records;
+};
+
+extern bool trace_enabled;
+
+void trace_event(unsigned event, const void *object, unsigned port, uint32_t arg);
+
+#define trace(event, object, port, arg) do { \
+	if (__builtin_expect(trace_enabled, 0)) \
+		trace_event(event, object, port, arg); \
+} while (0)
+
+#endif /* TRACE_H */
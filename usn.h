@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2009-2010 Felipe Contreras
+ * Copyright (C) 2026 agent
+ *
+ * Author: Felipe Contreras <felipe.contreras@gmail.com>
+ *
+ * This file may be used under the terms of the GNU Lesser General Public
+ * License version 2.1, a copy of which is found in LICENSE included in the
+ * packaging of this file.
+ */
+
+#ifndef USN_H
+#define USN_H
+
+#include <stdint.h>
+
+/* mpu <-> dsp communication structure */
+struct usn_comm {
+	uintptr_t buffer_data;
+	uint32_t buffer_size;
+	uintptr_t param_data;
+	uint32_t param_size;
+	uint32_t buffer_len;
+	uint32_t silly_eos;
+	uint32_t silly_buf_state;
+	uint32_t silly_buf_active;
+	uint32_t silly_buf_id;
+#if SN_API >= 2
+	uint32_t nb_available_buf;
+	uint32_t donot_flush_buf;
+	uint32_t donot_invalidate_buf;
+#endif
+	uint32_t reserved;
+	uintptr_t msg_virt;
+	uintptr_t buffer_virt;
+	uintptr_t param_virt;
+	uint32_t silly_out_buffer_index;
+	uint32_t silly_in_buffer_index;
+	uintptr_t user_data;
+	uint32_t stream_id;
+};
+
+typedef struct usn_comm usn_comm_t;
+
+#endif /* USN_H */
@@ -16,4 +16,45 @@
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Log-linear histogram buckets; exact below 4, then four per power of two,
+ * so a bucket is within 25% of the values it holds.
+ */
+static inline unsigned hist_bucket(uint64_t value)
+{
+	unsigned msb;
+
+	if (value < 4)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	return (msb - 1) * 4 + ((value >> (msb - 2)) & 3);
+}
+
+/* the largest value of a bucket */
+static inline uint64_t hist_value(unsigned bucket)
+{
+	unsigned msb;
+
+	if (bucket < 4)
+		return bucket;
+	msb = bucket / 4 + 1;
+	return ((uint64_t) (4 + bucket % 4 + 1) << (msb - 2)) - 1;
+}
+
+/* exponentially weighted moving average, 1/8 weight for the new sample */
+static inline void ewma(unsigned *avg, uint64_t sample)
+{
+	*avg = *avg ? (*avg * 7 + sample) / 8 : sample;
+}
+
 #endif